@@ -0,0 +1,119 @@
+// Load time and conversion throughput. Run with `cargo bench`; select a group with
+// e.g. `cargo bench -- convert/paragraph`.
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use opencc_fmmseg::dictionary_lib::DictionaryMaxlength;
+use opencc_fmmseg::{OpenCC, OpenccConfig, ParallelPolicy, DEFAULT_CACHE_MAX_INPUT_BYTES};
+
+const ONE_DAY: &str = include_str!("../tools/opencc-rs/OneDay.txt");
+const JSON_DICTIONARY: &str = concat!(
+    env!("CARGO_MANIFEST_DIR"),
+    "/src/dictionary_lib/dicts/dictionary_maxlength.json"
+);
+
+// Input shapes, from a single phrase up to a multi-MB corpus
+fn inputs() -> Vec<(&'static str, String)> {
+    let paragraph = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。\
+                     你好，意大利！SQL注入和U盘，软件打印机。龙马精神，汉字信息处理系统。";
+    vec![
+        ("short", "龙马精神！".to_string()),
+        ("paragraph", paragraph.to_string()),
+        ("one_day", ONE_DAY.to_string()),
+        (
+            "corpus_4mb",
+            ONE_DAY.repeat(4 * 1024 * 1024 / ONE_DAY.len()),
+        ),
+    ]
+}
+
+fn load(c: &mut Criterion) {
+    let mut group = c.benchmark_group("load");
+    group.sample_size(10);
+    group.bench_function("new", |b| b.iter(OpenCC::new));
+    // Tables are indexed lazily, so include the first conversion
+    group.bench_function("new_first_convert", |b| {
+        b.iter(|| OpenCC::new().convert(black_box("龙马精神"), "s2twp", true))
+    });
+    group.bench_function("from_dicts", |b| b.iter(DictionaryMaxlength::from_dicts));
+    group.bench_function("from_json", |b| {
+        b.iter(|| DictionaryMaxlength::from_json(JSON_DICTIONARY).unwrap())
+    });
+    group.finish();
+}
+
+fn convert(c: &mut Criterion) {
+    let opencc = OpenCC::new();
+    for (shape, input) in inputs() {
+        let mut group = c.benchmark_group(format!("convert/{}", shape));
+        group.throughput(Throughput::Bytes(input.len() as u64));
+        if input.len() > 1024 * 1024 {
+            group.sample_size(10);
+        }
+        for (mode, policy) in [
+            ("serial", ParallelPolicy::Serial),
+            ("parallel", ParallelPolicy::Parallel),
+        ] {
+            opencc.set_parallel_policy(policy);
+            for config in OpenccConfig::ALL {
+                let converter = opencc.converter(config, true);
+                // Build the lazy indexes outside the measurement
+                converter.convert(&input);
+                group.bench_with_input(
+                    BenchmarkId::new(config.as_str(), mode),
+                    &input,
+                    |b, input| b.iter(|| converter.convert(black_box(input))),
+                );
+            }
+        }
+        group.finish();
+    }
+}
+
+// Where going parallel starts to pay, to check DEFAULT_PARALLEL_THRESHOLD against
+fn parallel_threshold(c: &mut Criterion) {
+    let opencc = OpenCC::new();
+    let mut group = c.benchmark_group("parallel_threshold");
+    for kib in [4, 16, 32, 64, 256] {
+        let input = ONE_DAY.repeat(kib * 1024 / ONE_DAY.len() + 1);
+        group.throughput(Throughput::Bytes(input.len() as u64));
+        for (mode, policy) in [
+            ("serial", ParallelPolicy::Serial),
+            ("parallel", ParallelPolicy::Parallel),
+        ] {
+            opencc.set_parallel_policy(policy);
+            let converter = opencc.converter(OpenccConfig::S2twp, true);
+            group.bench_with_input(BenchmarkId::new(mode, kib), &input, |b, input| {
+                b.iter(|| converter.convert(black_box(input)))
+            });
+        }
+    }
+    group.finish();
+}
+
+// Repeated short strings, with and without the conversion cache
+fn cache(c: &mut Criterion) {
+    let opencc = OpenCC::new();
+    let phrases = [
+        "龙马精神",
+        "汉字信息处理系统",
+        "软件打印机",
+        "意大利罗浮宫",
+        "U盘",
+    ];
+    let mut group = c.benchmark_group("cache");
+    for (mode, capacity) in [("off", 0), ("on", 1024)] {
+        opencc.set_cache(capacity, DEFAULT_CACHE_MAX_INPUT_BYTES);
+        let converter = opencc.converter(OpenccConfig::S2twp, true);
+        group.bench_function(mode, |b| {
+            b.iter(|| {
+                for phrase in phrases {
+                    black_box(converter.convert(black_box(phrase)));
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, load, convert, parallel_threshold, cache);
+criterion_main!(benches);
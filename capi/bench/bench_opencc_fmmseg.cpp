@@ -0,0 +1,98 @@
+// Throughput of the C API, including FFI and allocation overhead, for comparison with
+// `cargo bench`. Usage: bench_opencc_fmmseg [text_file] (defaults to OneDay.txt)
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "opencc_fmmseg_capi.h"
+
+static const char *CONFIGS[] = {"s2t", "s2tw", "s2twp", "s2hk", "t2s", "t2tw", "t2twp", "t2hk", "tw2s", "tw2sp",
+                                "tw2t", "tw2tp", "hk2s", "hk2t", "jp2t", "t2jp", "auto2t", "auto2tw", "auto2twp",
+                                "auto2hk", "auto2s"};
+
+// Repeat fn until at least 200 ms have passed; returns seconds per call
+template <typename F>
+static double time_per_call(F fn) {
+    using clock = std::chrono::steady_clock;
+    fn();
+    size_t calls = 0;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed{};
+    do {
+        fn();
+        ++calls;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 0.2);
+    return elapsed.count() / calls;
+}
+
+static void report(const char *api, const char *config, const char *shape, const char *mode, size_t bytes,
+                   double seconds) {
+    std::printf("%-14s %-9s %-10s %-9s %10.3f us %9.2f MB/s\n", api, config, shape, mode, seconds * 1e6,
+                bytes / seconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "../../tools/opencc-rs/OneDay.txt";
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string one_day = contents.str();
+    std::string corpus;
+    while (corpus.size() < 4 * 1024 * 1024) {
+        corpus += one_day;
+    }
+    std::vector<std::pair<const char *, std::string>> inputs = {
+        {"short", u8"龙马精神！"},
+        {"paragraph", u8"意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。你好，意大利！SQL注入和U盘，软件打印机。"},
+        {"file", one_day},
+        {"corpus_4mb", corpus},
+    };
+
+    using clock = std::chrono::steady_clock;
+    auto load_start = clock::now();
+    void *opencc = opencc_new();
+    std::chrono::duration<double> load = clock::now() - load_start;
+    std::printf("opencc_new: %.3f ms\n", load.count() * 1e3);
+
+    std::vector<char> out_buf;
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        const char *mode = parallel ? "parallel" : "serial";
+        opencc_set_parallel_policy(opencc, parallel ? 1 : 0, 0, 0);
+        for (const char *config : CONFIGS) {
+            void *converter = opencc_converter_new(opencc, config, true);
+            for (const auto &[shape, input] : inputs) {
+                report("convert", config, shape, mode, input.size(), time_per_call([&] {
+                           char *result = opencc_convert(opencc, input.c_str(), config, true);
+                           opencc_string_free(result);
+                       }));
+                // Caller-owned buffer: size it once, then convert without allocating a result
+                size_t out_len = 0;
+                opencc_converter_convert_into(converter, input.data(), input.size(), nullptr, 0, &out_len);
+                out_buf.resize(out_len + 1);
+                report("convert_into", config, shape, mode, input.size(), time_per_call([&] {
+                           opencc_converter_convert_into(converter, input.data(), input.size(), out_buf.data(),
+                                                         out_buf.size(), &out_len);
+                       }));
+            }
+            // Many short strings in one call
+            std::vector<const char *> batch(1000, inputs[1].second.c_str());
+            report("convert_batch", config, "1000x", mode, 1000 * inputs[1].second.size(), time_per_call([&] {
+                       opencc_batch_t *results =
+                           opencc_converter_convert_batch(converter, batch.data(), nullptr, batch.size());
+                       opencc_batch_free(results);
+                   }));
+            opencc_converter_free(converter);
+        }
+    }
+    opencc_free(opencc);
+
+    return 0;
+}
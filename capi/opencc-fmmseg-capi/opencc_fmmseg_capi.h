@@ -0,0 +1,200 @@
+#ifndef OPENCC_FMMSEG_CAPI_H
+#define OPENCC_FMMSEG_CAPI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Thread safety: every function taking an instance or converter handle may be called concurrently on the
+ * same handle, including the parallel setters. Streams are not shared between threads. opencc_last_error
+ * reports the last error of the calling thread. The *_convert_into functions reuse per-thread scratch buffers
+ * instead of allocating a result per call.
+ */
+void *opencc_new();
+/*
+ * Handle whose dictionary tables for configs[0..count) are loaded up front; other tables load the first time
+ * a config needs them. Returns NULL if a config name is invalid.
+ */
+void *opencc_new_with_configs(const char *const *configs, size_t count);
+/* Handle on the process-wide shared dictionary, loaded once. */
+void *opencc_new_shared();
+/* New handle sharing the dictionary of instance, with its own settings (parallel flag, ...). */
+void *opencc_clone_handle(const void *instance);
+/*
+ * config is a name such as "s2twp". The auto configs "auto2t", "auto2tw", "auto2twp", "auto2hk" and "auto2s"
+ * detect the script of each input (as opencc_zho_check) and convert it to the target; input that needs no
+ * conversion is returned unchanged.
+ */
+char *opencc_convert(const void *instance, const char *input, const char *config, bool punctuation);
+/*
+ * Byte ranges of the input and the output replaced by one dictionary match, composed across the rounds of a
+ * config; with punctuation, each quote mark replaced is a span too. Text outside the spans is copied unchanged.
+ */
+typedef struct opencc_span {
+    size_t src_offset;
+    size_t src_len;
+    size_t dst_offset;
+    size_t dst_len;
+} opencc_span_t;
+
+/*
+ * Same as opencc_convert, also aligning the output with the input. *span_count receives the number of spans and
+ * the first spans_cap of them are written to spans (which may be NULL when spans_cap is 0); call again with a
+ * larger array if *span_count > spans_cap. Returns NULL on error.
+ */
+char *opencc_convert_with_spans(const void *instance, const char *input, const char *config, bool punctuation,
+                                opencc_span_t *spans, size_t spans_cap, size_t *span_count);
+/*
+ * Convert input_len bytes of UTF-8 (need not be NUL-terminated) into the caller-owned out_buf.
+ * *out_len receives the converted length excluding the NUL terminator; out_cap must be at least *out_len + 1.
+ * Returns 0 on success, 1 if out_buf is too small (nothing written), -1 on error.
+ */
+int opencc_convert_into(const void *instance, const char *input, size_t input_len, const char *config,
+                        bool punctuation, char *out_buf, size_t out_cap, size_t *out_len);
+/*
+ * Pre-resolved converter for one config and punctuation mode; instance must outlive it.
+ * Returns NULL for an invalid config. Results of opencc_converter_convert are freed with opencc_string_free.
+ */
+void *opencc_converter_new(const void *instance, const char *config, bool punctuation);
+char *opencc_converter_convert(const void *converter, const char *input);
+int opencc_converter_convert_into(const void *converter, const char *input, size_t input_len,
+                                  char *out_buf, size_t out_cap, size_t *out_len);
+void opencc_converter_free(void *converter);
+/*
+ * Streaming conversion for unbounded input. Feed input_len bytes at a time (a UTF-8 sequence may be split
+ * between calls); each call returns the output that is already final, freed with opencc_string_free.
+ * opencc_stream_finish flushes the rest. instance must outlive the stream.
+ */
+void *opencc_stream_new(const void *instance, const char *config, bool punctuation);
+char *opencc_stream_feed(void *stream, const char *input, size_t input_len);
+char *opencc_stream_finish(void *stream);
+void opencc_stream_free(void *stream);
+/*
+ * Outputs of opencc_convert_batch, all stored in one arena: output i starts at data + offsets[i],
+ * is lengths[i] bytes long and is followed by a NUL. Released with a single opencc_batch_free.
+ */
+typedef struct opencc_batch {
+    size_t count;
+    const char *data;
+    const size_t *offsets;
+    const size_t *lengths;
+} opencc_batch_t;
+
+/*
+ * Convert count strings in one call, in parallel across items when the instance is parallel.
+ * lens may be NULL when every input is NUL-terminated. Returns NULL on error (see opencc_last_error).
+ */
+opencc_batch_t *opencc_convert_batch(const void *instance, const char *const *inputs, const size_t *lens,
+                                     size_t count, const char *config, bool punctuation);
+opencc_batch_t *opencc_converter_convert_batch(const void *converter, const char *const *inputs, const size_t *lens,
+                                               size_t count);
+void opencc_batch_free(opencc_batch_t *batch);
+bool opencc_get_parallel(const void *instance);
+void opencc_set_parallel(const void *instance, bool is_parallel);
+/*
+ * mode 0: serial, 1: always parallel, 2: parallel for inputs of at least min_bytes (0 = default threshold).
+ * max_threads > 0 runs parallel work on a dedicated pool of that many threads. Returns 0 on success, -1 on error.
+ */
+int opencc_set_parallel_policy(const void *instance, int mode, size_t min_bytes, size_t max_threads);
+/*
+ * Opt-in conversion counters. opencc_set_stats_enabled starts collecting (conversions then run serially and
+ * round by round so each round can be timed); opencc_get_stats returns a snapshot, freed with opencc_stats_free.
+ * configs lists each config converted since the last reset. Auto configs are counted under the config they
+ * resolve to. match_lengths[n] counts dictionary matches of n characters; the last bucket holds longer ones.
+ */
+typedef struct opencc_round_stats {
+    uint64_t nanos;
+    uint64_t hits;   /* words replaced from the round's dictionaries */
+    uint64_t misses; /* characters left unchanged */
+} opencc_round_stats_t;
+
+typedef struct opencc_config_stats {
+    const char *config;
+    uint64_t calls;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t chunks; /* delimiter-bounded chunks the input was split into */
+    size_t round_count;
+    opencc_round_stats_t rounds[3];
+} opencc_config_stats_t;
+
+typedef struct opencc_stats {
+    size_t config_count;
+    const opencc_config_stats_t *configs;
+    uint64_t match_lengths[17];
+} opencc_stats_t;
+
+void opencc_set_stats_enabled(const void *instance, bool enabled);
+opencc_stats_t *opencc_get_stats(const void *instance);
+void opencc_reset_stats(const void *instance);
+void opencc_stats_free(opencc_stats_t *stats);
+/*
+ * Memoize conversions of inputs of at most max_input_bytes, up to capacity entries (CLOCK eviction); either
+ * being 0 turns the cache off. Reconfiguring empties the cache and zeroes its counters. Streams bypass it.
+ */
+typedef struct opencc_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t entries;
+    size_t capacity;
+} opencc_cache_stats_t;
+
+void opencc_set_cache(const void *instance, size_t capacity, size_t max_input_bytes);
+/* Returns 0 on success, -1 on error. */
+int opencc_get_cache_stats(const void *instance, opencc_cache_stats_t *stats);
+/*
+ * Overlay a user dictionary on the instance. The file uses the format of the built-in dictionary .txt files and is
+ * named after the table it overlays (e.g. "STPhrases.txt"); its entries win over built-in words of the same
+ * length in every round reading that table. Loading again adds entries. Updates never block running
+ * conversions; converters and streams created earlier keep the entries they started with.
+ * Returns 0 on success, -1 on error (see opencc_last_error).
+ */
+int opencc_load_user_dict(const void *instance, const char *path);
+void opencc_clear_user_dicts(const void *instance);
+/*
+ * Non-blocking conversion for event-loop hosts. opencc_convert_async copies the input, queues the conversion on
+ * the instance's pool (its dedicated pool under opencc_set_parallel_policy max_threads, else the global one) and
+ * returns a task handle at once, or NULL when the arguments are invalid or the queue is full (see
+ * opencc_last_error); at most opencc_set_async_queue_limit conversions (default 1024) are queued or running
+ * per instance. The callback runs exactly once on a pool thread; output is NULL unless status is
+ * OPENCC_ASYNC_OK and is freed with opencc_string_free. OPENCC_ASYNC_ERROR means a dictionary table failed to
+ * load, with opencc_last_error set on the callback's thread. Pending tasks hold a reference to instance, so
+ * opencc_free may be called before they finish.
+ */
+#define OPENCC_ASYNC_OK 0
+#define OPENCC_ASYNC_CANCELLED 1
+#define OPENCC_ASYNC_ERROR (-1)
+
+typedef void (*opencc_convert_callback)(void *user_data, int status, char *output, size_t output_len);
+
+void *opencc_convert_async(const void *instance, const char *input, size_t input_len, const char *config,
+                           bool punctuation, opencc_convert_callback callback, void *user_data);
+/* Returns 0 if the task had not started (its queue slot is freed at once and its callback reports
+ * OPENCC_ASYNC_CANCELLED later), -1 otherwise. */
+int opencc_async_cancel(const void *task);
+/* 0: queued, 1: running, 2: done (callback returned), 3: cancelled. */
+int opencc_async_status(const void *task);
+/* Releases the handle only; the task still completes. */
+void opencc_async_free(void *task);
+void opencc_set_async_queue_limit(const void *instance, size_t limit);
+size_t opencc_async_pending(const void *instance);
+int opencc_zho_check(const void *instance, const char *input);
+/*
+ * Same as opencc_zho_check (1: Traditional, 2: Simplified, 0: neither). *confidence, if not NULL, receives
+ * the share (0 to 1) of script-specific characters in the scanned prefix that agree with the result.
+ */
+int opencc_zho_check_confidence(const void *instance, const char *input, double *confidence);
+void opencc_free(const void *instance);
+void opencc_string_free(const char *ptr);
+char *opencc_last_error();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OPENCC_FMMSEG_CAPI_H
@@ -1,32 +1,141 @@
-use opencc_fmmseg::OpenCC;
+use std::cell::RefCell;
+use std::sync::Arc;
+
+use opencc_fmmseg::{
+    ConversionStream, Converter, JobHandle, JobState, OpenCC, OpenccConfig, ParallelPolicy,
+    MATCH_LENGTH_BUCKETS, MAX_ROUNDS,
+};
 
 #[no_mangle]
 pub extern "C" fn opencc_new() -> *mut OpenCC {
-    Box::into_raw(Box::new(OpenCC::new()))
+    instance_into_raw(OpenCC::new())
+}
+
+// Handle with the dictionary tables of `configs` loaded up front; other tables load on
+// first use. Returns null if a config name is invalid.
+#[no_mangle]
+pub extern "C" fn opencc_new_with_configs(
+    configs: *const *const std::os::raw::c_char,
+    count: usize,
+) -> *mut OpenCC {
+    if configs.is_null() && count > 0 {
+        return std::ptr::null_mut();
+    }
+    let mut resolved = Vec::with_capacity(count);
+    for i in 0..count {
+        let config = unsafe { *configs.add(i) };
+        if config.is_null() {
+            return std::ptr::null_mut();
+        }
+        match unsafe { config_from_raw(config) } {
+            Some(config) => resolved.push(config),
+            None => return std::ptr::null_mut(),
+        }
+    }
+    let opencc = OpenCC::new();
+    for config in resolved {
+        if let Err(err) = opencc.preload(config) {
+            OpenCC::set_last_error(&err.to_string());
+        }
+    }
+    instance_into_raw(opencc)
 }
 
+// Handle on the process-wide shared dictionary; cheap after the first call
+#[no_mangle]
+pub extern "C" fn opencc_new_shared() -> *mut OpenCC {
+    instance_into_raw(OpenCC::new_shared())
+}
+
+// New handle sharing the dictionary of `instance`, with its own settings
+#[no_mangle]
+pub extern "C" fn opencc_clone_handle(instance: *const OpenCC) -> *mut OpenCC {
+    if instance.is_null() {
+        return std::ptr::null_mut();
+    }
+    let opencc = unsafe { &*instance };
+    instance_into_raw(opencc.clone_handle())
+}
+
+// Instances are reference-counted so that queued async conversions keep theirs alive
+fn instance_into_raw(opencc: OpenCC) -> *mut OpenCC {
+    Arc::into_raw(Arc::new(opencc)) as *mut OpenCC
+}
+
+// Drop the caller's reference; async conversions still pending hold their own
 #[no_mangle]
 pub extern "C" fn opencc_free(instance: *mut OpenCC) {
     if !instance.is_null() {
-        // Convert the raw pointer back into a Box and let it drop
+        // Convert the raw pointer back into an Arc and let it drop
         unsafe {
-            let _ = Box::from_raw(instance);
+            let _ = Arc::from_raw(instance as *const OpenCC);
         };
     }
 }
 
 #[no_mangle]
-pub extern "C" fn opencc_get_parallel(instance: *mut OpenCC) -> bool {
+pub extern "C" fn opencc_get_parallel(instance: *const OpenCC) -> bool {
+    if instance.is_null() {
+        return false;
+    }
     let opencc = unsafe { &*instance };
     opencc.get_parallel()
 }
 
+// Settings are atomic, so this is safe while other threads convert with the handle
 #[no_mangle]
-pub extern "C" fn opencc_set_parallel(instance: *mut OpenCC, is_parallel: bool) {
-    let opencc = unsafe { &mut *instance };
+pub extern "C" fn opencc_set_parallel(instance: *const OpenCC, is_parallel: bool) {
+    if instance.is_null() {
+        return;
+    }
+    let opencc = unsafe { &*instance };
     opencc.set_parallel(is_parallel);
 }
 
+// mode 0: serial, 1: always parallel, 2: parallel for inputs of at least min_bytes
+// (0 selects the default threshold). max_threads > 0 runs parallel work on a dedicated
+// pool of that many threads. Returns 0 on success, -1 on error.
+#[no_mangle]
+pub extern "C" fn opencc_set_parallel_policy(
+    instance: *const OpenCC,
+    mode: i32,
+    min_bytes: usize,
+    max_threads: usize,
+) -> i32 {
+    if instance.is_null() {
+        return -1;
+    }
+    let opencc = unsafe { &*instance };
+    let threshold = match mode {
+        0 => {
+            opencc.set_parallel_policy(ParallelPolicy::Serial);
+            return 0;
+        }
+        1 => 0,
+        2 if min_bytes == 0 => opencc_fmmseg::DEFAULT_PARALLEL_THRESHOLD,
+        2 => min_bytes,
+        _ => {
+            OpenCC::set_last_error(&format!("Invalid parallel policy mode: {}", mode));
+            return -1;
+        }
+    };
+    let policy = if max_threads > 0 {
+        match ParallelPolicy::with_max_threads(max_threads, threshold) {
+            Ok(policy) => policy,
+            Err(err) => {
+                OpenCC::set_last_error(&format!("Failed to build thread pool: {}", err));
+                return -1;
+            }
+        }
+    } else if mode == 1 {
+        ParallelPolicy::Parallel
+    } else {
+        ParallelPolicy::Threshold(threshold)
+    };
+    opencc.set_parallel_policy(policy);
+    0
+}
+
 #[no_mangle]
 pub extern "C" fn opencc_convert(
     instance: *const OpenCC,
@@ -56,6 +165,785 @@ pub extern "C" fn opencc_convert(
     c_result.into_raw()
 }
 
+#[repr(C)]
+pub struct OpenccSpan {
+    pub src_offset: usize,
+    pub src_len: usize,
+    pub dst_offset: usize,
+    pub dst_len: usize,
+}
+
+// Like opencc_convert, also aligning each dictionary match of the output with the input.
+// `span_count` receives the number of spans; the first `spans_cap` are written to `spans`
+// (which may be null when `spans_cap` is 0), so a larger array can be passed on retry.
+#[no_mangle]
+pub extern "C" fn opencc_convert_with_spans(
+    instance: *const OpenCC,
+    input: *const std::os::raw::c_char,
+    config: *const std::os::raw::c_char,
+    punctuation: bool,
+    spans: *mut OpenccSpan,
+    spans_cap: usize,
+    span_count: *mut usize,
+) -> *mut std::os::raw::c_char {
+    if instance.is_null() || input.is_null() || config.is_null() || span_count.is_null() {
+        return std::ptr::null_mut();
+    }
+    if spans.is_null() && spans_cap > 0 {
+        return std::ptr::null_mut();
+    }
+    let opencc = unsafe { &*instance };
+    let config = match unsafe { config_from_raw(config) } {
+        Some(config) => config,
+        None => return std::ptr::null_mut(),
+    };
+    let input = unsafe { std::ffi::CStr::from_ptr(input) }
+        .to_str()
+        .unwrap_or("");
+    let (output, found) = opencc
+        .converter_for(config, punctuation, input)
+        .convert_with_spans(input);
+    unsafe {
+        *span_count = found.len();
+        for (i, span) in found.iter().take(spans_cap).enumerate() {
+            *spans.add(i) = OpenccSpan {
+                src_offset: span.src_offset,
+                src_len: span.src_len,
+                dst_offset: span.dst_offset,
+                dst_len: span.dst_len,
+            };
+        }
+    }
+    string_into_raw(output)
+}
+
+// Convert `input_len` bytes of UTF-8 input (not necessarily NUL-terminated) into a
+// caller-owned buffer. `out_len` always receives the converted length in bytes, excluding
+// the NUL terminator, so the buffer needs at least `out_len + 1` bytes.
+// Returns 0 on success, 1 if `out_buf` is too small (nothing is written) and -1 on error.
+#[no_mangle]
+pub extern "C" fn opencc_convert_into(
+    instance: *const OpenCC,
+    input: *const std::os::raw::c_char,
+    input_len: usize,
+    config: *const std::os::raw::c_char,
+    punctuation: bool,
+    out_buf: *mut std::os::raw::c_char,
+    out_cap: usize,
+    out_len: *mut usize,
+) -> i32 {
+    if instance.is_null() || config.is_null() || (input.is_null() && input_len > 0) {
+        return -1;
+    }
+    let opencc = unsafe { &*instance };
+    let config = match unsafe { config_from_raw(config) } {
+        Some(config) => config,
+        None => return -1,
+    };
+    let input_str_slice = match unsafe { input_str_from_raw(input, input_len) } {
+        Some(s) => s,
+        None => return -1,
+    };
+
+    let converter = opencc.converter_for(config, punctuation, input_str_slice);
+
+    unsafe { convert_to_buffer(&converter, input_str_slice, out_buf, out_cap, out_len) }
+}
+
+// Resolve a config once; the returned handle borrows `instance`, which must outlive it.
+// Returns null (and sets the last error) for an invalid config.
+#[no_mangle]
+pub extern "C" fn opencc_converter_new(
+    instance: *const OpenCC,
+    config: *const std::os::raw::c_char,
+    punctuation: bool,
+) -> *mut Converter<'static> {
+    if instance.is_null() || config.is_null() {
+        return std::ptr::null_mut();
+    }
+    let opencc = unsafe { &*instance };
+    match unsafe { config_from_raw(config) } {
+        Some(config) => Box::into_raw(Box::new(opencc.converter(config, punctuation))),
+        None => std::ptr::null_mut(),
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_converter_free(converter: *mut Converter<'static>) {
+    if !converter.is_null() {
+        unsafe {
+            let _ = Box::from_raw(converter);
+        };
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_converter_convert(
+    converter: *const Converter<'static>,
+    input: *const std::os::raw::c_char,
+) -> *mut std::os::raw::c_char {
+    if converter.is_null() || input.is_null() {
+        return std::ptr::null_mut();
+    }
+    let converter = unsafe { &*converter };
+    let input_str_slice = unsafe { std::ffi::CStr::from_ptr(input) }
+        .to_str()
+        .unwrap_or("");
+
+    let result = converter.convert(input_str_slice);
+
+    std::ffi::CString::new(result).unwrap().into_raw()
+}
+
+// Same contract as opencc_convert_into, using a pre-resolved converter handle
+#[no_mangle]
+pub extern "C" fn opencc_converter_convert_into(
+    converter: *const Converter<'static>,
+    input: *const std::os::raw::c_char,
+    input_len: usize,
+    out_buf: *mut std::os::raw::c_char,
+    out_cap: usize,
+    out_len: *mut usize,
+) -> i32 {
+    if converter.is_null() || (input.is_null() && input_len > 0) {
+        return -1;
+    }
+    let converter = unsafe { &*converter };
+    let input_str_slice = match unsafe { input_str_from_raw(input, input_len) } {
+        Some(s) => s,
+        None => return -1,
+    };
+
+    unsafe { convert_to_buffer(converter, input_str_slice, out_buf, out_cap, out_len) }
+}
+
+// Streaming conversion: feed input in pieces of any size (UTF-8 sequences may be split
+// between calls) and get back the output that is already final. The instance must
+// outlive the stream.
+#[no_mangle]
+pub extern "C" fn opencc_stream_new(
+    instance: *const OpenCC,
+    config: *const std::os::raw::c_char,
+    punctuation: bool,
+) -> *mut ConversionStream<'static> {
+    if instance.is_null() || config.is_null() {
+        return std::ptr::null_mut();
+    }
+    let opencc = unsafe { &*instance };
+    match unsafe { config_from_raw(config) } {
+        Some(config) => Box::into_raw(Box::new(opencc.stream(config, punctuation))),
+        None => std::ptr::null_mut(),
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_stream_feed(
+    stream: *mut ConversionStream<'static>,
+    input: *const std::os::raw::c_char,
+    input_len: usize,
+) -> *mut std::os::raw::c_char {
+    if stream.is_null() || (input.is_null() && input_len > 0) {
+        return std::ptr::null_mut();
+    }
+    let stream = unsafe { &mut *stream };
+    let bytes = if input_len == 0 {
+        &[][..]
+    } else {
+        unsafe { std::slice::from_raw_parts(input as *const u8, input_len) }
+    };
+
+    string_into_raw(stream.feed(bytes))
+}
+
+// Flush the output still held back; the stream can then be fed again or freed
+#[no_mangle]
+pub extern "C" fn opencc_stream_finish(
+    stream: *mut ConversionStream<'static>,
+) -> *mut std::os::raw::c_char {
+    if stream.is_null() {
+        return std::ptr::null_mut();
+    }
+    let stream = unsafe { &mut *stream };
+
+    string_into_raw(stream.finish())
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_stream_free(stream: *mut ConversionStream<'static>) {
+    if !stream.is_null() {
+        unsafe {
+            let _ = Box::from_raw(stream);
+        };
+    }
+}
+
+// Result of opencc_convert_batch: every output lives in one arena, each followed by a
+// NUL, so the whole batch is released by a single opencc_batch_free
+#[repr(C)]
+pub struct OpenccBatch {
+    pub count: usize,
+    pub data: *const std::os::raw::c_char,
+    pub offsets: *const usize,
+    pub lengths: *const usize,
+}
+
+// Owns the memory behind an OpenccBatch; `batch` must stay the first field so the
+// pointer handed to C can be cast back on free
+#[repr(C)]
+struct OpenccBatchOwner {
+    batch: OpenccBatch,
+    data: Vec<u8>,
+    offsets: Vec<usize>,
+    lengths: Vec<usize>,
+}
+
+// Convert `count` strings in a single call. `lens` may be null, in which case every
+// input must be NUL-terminated. Items are converted in parallel (when enabled on the
+// instance) rather than each item being split further. Returns null (and sets the
+// last error) on error.
+#[no_mangle]
+pub extern "C" fn opencc_convert_batch(
+    instance: *const OpenCC,
+    inputs: *const *const std::os::raw::c_char,
+    lens: *const usize,
+    count: usize,
+    config: *const std::os::raw::c_char,
+    punctuation: bool,
+) -> *mut OpenccBatch {
+    if instance.is_null() || config.is_null() {
+        return std::ptr::null_mut();
+    }
+    let opencc = unsafe { &*instance };
+    let config = match unsafe { config_from_raw(config) } {
+        Some(config) => config,
+        None => return std::ptr::null_mut(),
+    };
+    let texts = match unsafe { batch_inputs_from_raw(inputs, lens, count) } {
+        Some(texts) => texts,
+        None => return std::ptr::null_mut(),
+    };
+
+    batch_from_results(opencc.converter(config, punctuation).convert_batch(&texts))
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_converter_convert_batch(
+    converter: *const Converter<'static>,
+    inputs: *const *const std::os::raw::c_char,
+    lens: *const usize,
+    count: usize,
+) -> *mut OpenccBatch {
+    if converter.is_null() {
+        return std::ptr::null_mut();
+    }
+    let converter = unsafe { &*converter };
+    let texts = match unsafe { batch_inputs_from_raw(inputs, lens, count) } {
+        Some(texts) => texts,
+        None => return std::ptr::null_mut(),
+    };
+
+    batch_from_results(converter.convert_batch(&texts))
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_batch_free(batch: *mut OpenccBatch) {
+    if !batch.is_null() {
+        unsafe {
+            let _ = Box::from_raw(batch as *mut OpenccBatchOwner);
+        };
+    }
+}
+
+// opencc_fmmseg_capi.h declares the arrays with these sizes
+const _: () = assert!(MAX_ROUNDS == 3 && MATCH_LENGTH_BUCKETS == 17);
+
+#[repr(C)]
+pub struct OpenccRoundStats {
+    pub nanos: u64,
+    pub hits: u64,
+    pub misses: u64,
+}
+
+#[repr(C)]
+pub struct OpenccConfigStats {
+    pub config: *const std::os::raw::c_char,
+    pub calls: u64,
+    pub bytes_in: u64,
+    pub bytes_out: u64,
+    pub chunks: u64,
+    pub round_count: usize,
+    pub rounds: [OpenccRoundStats; MAX_ROUNDS],
+}
+
+#[repr(C)]
+pub struct OpenccStats {
+    pub config_count: usize,
+    pub configs: *const OpenccConfigStats,
+    pub match_lengths: [u64; MATCH_LENGTH_BUCKETS],
+}
+
+// Owns the memory behind an OpenccStats, laid out like OpenccBatchOwner
+#[repr(C)]
+struct OpenccStatsOwner {
+    stats: OpenccStats,
+    configs: Vec<OpenccConfigStats>,
+    names: Vec<std::ffi::CString>,
+}
+
+// Counters are only collected while enabled; enabling makes conversions on the
+// instance serial and round by round so that rounds can be timed
+#[no_mangle]
+pub extern "C" fn opencc_set_stats_enabled(instance: *const OpenCC, enabled: bool) {
+    if instance.is_null() {
+        return;
+    }
+    unsafe { &*instance }.set_stats_enabled(enabled);
+}
+
+// Snapshot of the counters, freed with opencc_stats_free
+#[no_mangle]
+pub extern "C" fn opencc_get_stats(instance: *const OpenCC) -> *mut OpenccStats {
+    if instance.is_null() {
+        return std::ptr::null_mut();
+    }
+    let snapshot = unsafe { &*instance }.stats();
+    let names: Vec<std::ffi::CString> = snapshot
+        .configs
+        .iter()
+        .map(|stats| std::ffi::CString::new(stats.config.as_str()).unwrap())
+        .collect();
+    let configs = snapshot
+        .configs
+        .iter()
+        .zip(&names)
+        .map(|(stats, name)| {
+            let rounds = std::array::from_fn(|index| {
+                let totals = stats.rounds.get(index).copied().unwrap_or_default();
+                OpenccRoundStats {
+                    nanos: totals.nanos,
+                    hits: totals.hits,
+                    misses: totals.misses,
+                }
+            });
+            OpenccConfigStats {
+                config: name.as_ptr(),
+                calls: stats.calls,
+                bytes_in: stats.bytes_in,
+                bytes_out: stats.bytes_out,
+                chunks: stats.chunks,
+                round_count: stats.rounds.len(),
+                rounds,
+            }
+        })
+        .collect();
+    let mut owner = Box::new(OpenccStatsOwner {
+        stats: OpenccStats {
+            config_count: snapshot.configs.len(),
+            configs: std::ptr::null(),
+            match_lengths: snapshot.match_lengths,
+        },
+        configs,
+        names,
+    });
+    owner.stats.configs = owner.configs.as_ptr();
+
+    Box::into_raw(owner) as *mut OpenccStats
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_reset_stats(instance: *const OpenCC) {
+    if instance.is_null() {
+        return;
+    }
+    unsafe { &*instance }.reset_stats();
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_stats_free(stats: *mut OpenccStats) {
+    if !stats.is_null() {
+        unsafe {
+            let _ = Box::from_raw(stats as *mut OpenccStatsOwner);
+        };
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_set_cache(
+    instance: *const OpenCC,
+    capacity: usize,
+    max_input_bytes: usize,
+) {
+    if instance.is_null() {
+        return;
+    }
+    unsafe { &*instance }.set_cache(capacity, max_input_bytes);
+}
+
+// Overlay a user dictionary file named after a built-in table (e.g. "STPhrases.txt")
+#[no_mangle]
+pub extern "C" fn opencc_load_user_dict(
+    instance: *const OpenCC,
+    path: *const std::os::raw::c_char,
+) -> i32 {
+    if instance.is_null() || path.is_null() {
+        return -1;
+    }
+    let path = unsafe { std::ffi::CStr::from_ptr(path) }.to_string_lossy();
+    match unsafe { &*instance }.load_user_dict(&path) {
+        Ok(()) => 0,
+        Err(err) => {
+            OpenCC::set_last_error(&format!("Failed to load user dictionary: {}", err));
+            -1
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_clear_user_dicts(instance: *const OpenCC) {
+    if instance.is_null() {
+        return;
+    }
+    unsafe { &*instance }.clear_overlays();
+}
+
+#[repr(C)]
+pub struct OpenccCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub entries: usize,
+    pub capacity: usize,
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_get_cache_stats(
+    instance: *const OpenCC,
+    stats: *mut OpenccCacheStats,
+) -> i32 {
+    if instance.is_null() || stats.is_null() {
+        return -1;
+    }
+    let cache = unsafe { &*instance }.cache_stats();
+    unsafe {
+        *stats = OpenccCacheStats {
+            hits: cache.hits,
+            misses: cache.misses,
+            entries: cache.entries,
+            capacity: cache.capacity,
+        };
+    }
+    0
+}
+
+// Completion callback of opencc_convert_async, called exactly once on a pool thread.
+// `output` (NUL-terminated, `output_len` bytes) is owned by the callee and freed with
+// opencc_string_free; it is null unless `status` is OPENCC_ASYNC_OK.
+pub type OpenccConvertCallback = extern "C" fn(
+    user_data: *mut std::os::raw::c_void,
+    status: i32,
+    output: *mut std::os::raw::c_char,
+    output_len: usize,
+);
+
+pub const OPENCC_ASYNC_OK: i32 = 0;
+pub const OPENCC_ASYNC_CANCELLED: i32 = 1;
+pub const OPENCC_ASYNC_ERROR: i32 = -1;
+
+// Handle on one queued conversion
+pub struct OpenccAsyncTask {
+    job: JobHandle,
+}
+
+// The job's share of the instance, and the caller pointer handed back to the callback
+struct AsyncContext {
+    instance: Arc<OpenCC>,
+    user_data: *mut std::os::raw::c_void,
+}
+
+unsafe impl Send for AsyncContext {}
+
+// Queue a conversion on the instance's pool and return at once; the input is copied, so
+// the caller may free it right away. Returns a task handle (released with
+// opencc_async_free), or null with the last error set for invalid arguments or when
+// the instance's queue is full.
+#[no_mangle]
+pub extern "C" fn opencc_convert_async(
+    instance: *const OpenCC,
+    input: *const std::os::raw::c_char,
+    input_len: usize,
+    config: *const std::os::raw::c_char,
+    punctuation: bool,
+    callback: Option<OpenccConvertCallback>,
+    user_data: *mut std::os::raw::c_void,
+) -> *mut OpenccAsyncTask {
+    let callback = match callback {
+        Some(callback) if !instance.is_null() && !config.is_null() => callback,
+        _ => return std::ptr::null_mut(),
+    };
+    if input.is_null() && input_len > 0 {
+        return std::ptr::null_mut();
+    }
+    let config = match unsafe { config_from_raw(config) } {
+        Some(config) => config,
+        None => return std::ptr::null_mut(),
+    };
+    let input = match unsafe { input_str_from_raw(input, input_len) } {
+        Some(s) => s.to_owned(),
+        None => return std::ptr::null_mut(),
+    };
+
+    // The instance came from instance_into_raw; take a reference of the job's own
+    let instance = unsafe {
+        Arc::increment_strong_count(instance);
+        Arc::from_raw(instance)
+    };
+    let context = AsyncContext {
+        instance: Arc::clone(&instance),
+        user_data,
+    };
+    let job = move |cancelled: bool| {
+        let context = context;
+        if cancelled {
+            callback(
+                context.user_data,
+                OPENCC_ASYNC_CANCELLED,
+                std::ptr::null_mut(),
+                0,
+            );
+            return;
+        }
+        // Dictionary tables that fail to load report through the last error
+        OpenCC::take_last_error();
+        let output = context
+            .instance
+            .converter_for(config, punctuation, &input)
+            .convert(&input);
+        if let Some(err) = OpenCC::take_last_error() {
+            // Left set for opencc_last_error in the callback
+            OpenCC::set_last_error(&err);
+            callback(
+                context.user_data,
+                OPENCC_ASYNC_ERROR,
+                std::ptr::null_mut(),
+                0,
+            );
+            return;
+        }
+        let output_len = output.len();
+        let output = string_into_raw(output);
+        let status = if output.is_null() {
+            OPENCC_ASYNC_ERROR
+        } else {
+            OPENCC_ASYNC_OK
+        };
+        callback(context.user_data, status, output, output_len);
+    };
+    match instance.spawn(job) {
+        Some(job) => Box::into_raw(Box::new(OpenccAsyncTask { job })),
+        None => {
+            OpenCC::set_last_error("Async queue is full");
+            std::ptr::null_mut()
+        }
+    }
+}
+
+// Cancel a task that has not started; its queue slot is freed at once and its callback
+// later reports OPENCC_ASYNC_CANCELLED. Returns 0 if cancelled, -1 if the task already
+// started (or was cancelled before).
+#[no_mangle]
+pub extern "C" fn opencc_async_cancel(task: *const OpenccAsyncTask) -> i32 {
+    if task.is_null() || !unsafe { &*task }.job.cancel() {
+        return -1;
+    }
+    0
+}
+
+// 0: queued, 1: running, 2: done (callback returned), 3: cancelled; -1 for null
+#[no_mangle]
+pub extern "C" fn opencc_async_status(task: *const OpenccAsyncTask) -> i32 {
+    if task.is_null() {
+        return -1;
+    }
+    match unsafe { &*task }.job.state() {
+        JobState::Queued => 0,
+        JobState::Running => 1,
+        JobState::Done => 2,
+        JobState::Cancelled => 3,
+    }
+}
+
+// Release the caller's task handle; a queued or running task still completes
+#[no_mangle]
+pub extern "C" fn opencc_async_free(task: *mut OpenccAsyncTask) {
+    if !task.is_null() {
+        unsafe {
+            drop(Box::from_raw(task));
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn opencc_set_async_queue_limit(instance: *const OpenCC, limit: usize) {
+    if instance.is_null() {
+        return;
+    }
+    unsafe { &*instance }.set_max_pending_jobs(limit);
+}
+
+// Async conversions of the instance queued or running
+#[no_mangle]
+pub extern "C" fn opencc_async_pending(instance: *const OpenCC) -> usize {
+    if instance.is_null() {
+        return 0;
+    }
+    unsafe { &*instance }.pending_jobs()
+}
+
+// Hand a result to C; NUL bytes cannot be represented in a C string
+fn string_into_raw(result: String) -> *mut std::os::raw::c_char {
+    match std::ffi::CString::new(result) {
+        Ok(c_string) => c_string.into_raw(),
+        Err(_) => {
+            OpenCC::set_last_error("Output contains a NUL byte");
+            std::ptr::null_mut()
+        }
+    }
+}
+
+// Borrow the inputs of a batch call; `lens` may be null for NUL-terminated inputs
+unsafe fn batch_inputs_from_raw<'a>(
+    inputs: *const *const std::os::raw::c_char,
+    lens: *const usize,
+    count: usize,
+) -> Option<Vec<&'a str>> {
+    if count == 0 {
+        return Some(Vec::new());
+    }
+    if inputs.is_null() {
+        return None;
+    }
+    let mut texts = Vec::with_capacity(count);
+    for i in 0..count {
+        let input = *inputs.add(i);
+        let len = if lens.is_null() {
+            if input.is_null() {
+                return None;
+            }
+            std::ffi::CStr::from_ptr(input).to_bytes().len()
+        } else {
+            *lens.add(i)
+        };
+        if input.is_null() && len > 0 {
+            return None;
+        }
+        texts.push(input_str_from_raw(input, len)?);
+    }
+    Some(texts)
+}
+
+// Pack converted strings into one arena, each followed by a NUL
+fn batch_from_results(results: Vec<String>) -> *mut OpenccBatch {
+    let mut data = Vec::with_capacity(results.iter().map(|result| result.len() + 1).sum());
+    let mut offsets = Vec::with_capacity(results.len());
+    let mut lengths = Vec::with_capacity(results.len());
+    for result in &results {
+        offsets.push(data.len());
+        lengths.push(result.len());
+        data.extend_from_slice(result.as_bytes());
+        data.push(0);
+    }
+
+    let mut owner = Box::new(OpenccBatchOwner {
+        batch: OpenccBatch {
+            count: results.len(),
+            data: std::ptr::null(),
+            offsets: std::ptr::null(),
+            lengths: std::ptr::null(),
+        },
+        data,
+        offsets,
+        lengths,
+    });
+    owner.batch.data = owner.data.as_ptr() as *const std::os::raw::c_char;
+    owner.batch.offsets = owner.offsets.as_ptr();
+    owner.batch.lengths = owner.lengths.as_ptr();
+    Box::into_raw(owner) as *mut OpenccBatch
+}
+
+// Parse a C config name; sets the last error when it is not a known config
+unsafe fn config_from_raw(config: *const std::os::raw::c_char) -> Option<OpenccConfig> {
+    let config_str_slice = std::ffi::CStr::from_ptr(config).to_str().unwrap_or("");
+    let resolved = OpenccConfig::from_name(config_str_slice);
+    if resolved.is_none() {
+        OpenCC::set_last_error(&format!("Invalid config: {}", config_str_slice));
+    }
+    resolved
+}
+
+// Borrow a length-delimited C buffer as &str; sets the last error on invalid UTF-8
+unsafe fn input_str_from_raw<'a>(
+    input: *const std::os::raw::c_char,
+    input_len: usize,
+) -> Option<&'a str> {
+    if input_len == 0 {
+        return Some("");
+    }
+    let bytes = std::slice::from_raw_parts(input as *const u8, input_len);
+    match std::str::from_utf8(bytes) {
+        Ok(s) => Some(s),
+        Err(err) => {
+            OpenCC::set_last_error(&format!("Invalid UTF-8 input: {}", err));
+            None
+        }
+    }
+}
+
+thread_local! {
+    // Per-thread output scratch of the *_convert_into functions, reused across calls
+    static OUTPUT_BUFFER: RefCell<String> = RefCell::new(String::new());
+}
+
+// Convert into the calling thread's scratch, then copy into the caller-owned buffer
+unsafe fn convert_to_buffer(
+    converter: &Converter,
+    input: &str,
+    out_buf: *mut std::os::raw::c_char,
+    out_cap: usize,
+    out_len: *mut usize,
+) -> i32 {
+    OUTPUT_BUFFER.with(|buffer| match buffer.try_borrow_mut() {
+        Ok(mut output) => {
+            converter.convert_to(input, &mut output);
+            let status = write_to_buffer(&output, out_buf, out_cap, out_len);
+            if output.capacity() > OUTPUT_BUFFER_LIMIT {
+                *output = String::new();
+            }
+            status
+        }
+        Err(_) => write_to_buffer(&converter.convert(input), out_buf, out_cap, out_len),
+    })
+}
+
+// Scratch beyond this size is released after the call instead of kept for the thread
+const OUTPUT_BUFFER_LIMIT: usize = 1 << 20;
+
+// Copy a result into a caller-owned buffer, NUL-terminated
+unsafe fn write_to_buffer(
+    result: &str,
+    out_buf: *mut std::os::raw::c_char,
+    out_cap: usize,
+    out_len: *mut usize,
+) -> i32 {
+    if !out_len.is_null() {
+        *out_len = result.len();
+    }
+    if out_buf.is_null() || out_cap <= result.len() {
+        return 1;
+    }
+    std::ptr::copy_nonoverlapping(result.as_ptr(), out_buf as *mut u8, result.len());
+    *out_buf.add(result.len()) = 0;
+    0
+}
+
 // Remember to free the memory allocated for the result string from C code
 #[no_mangle]
 pub extern "C" fn opencc_string_free(ptr: *mut std::os::raw::c_char) {
@@ -82,6 +970,28 @@ pub extern "C" fn opencc_zho_check(
     opencc.zho_check(str_slice)
 }
 
+// Same result as opencc_zho_check; *confidence (when not null) receives the share of
+// script-specific chars that agree with it
+#[no_mangle]
+pub extern "C" fn opencc_zho_check_confidence(
+    instance: *const OpenCC,
+    input: *const std::os::raw::c_char,
+    confidence: *mut f64,
+) -> i32 {
+    if instance.is_null() || input.is_null() {
+        return -1;
+    }
+    let opencc = unsafe { &*instance };
+    let str_slice = unsafe { std::ffi::CStr::from_ptr(input) }
+        .to_str()
+        .unwrap_or("");
+    let (code, score) = opencc.zho_check_with_confidence(str_slice);
+    if !confidence.is_null() {
+        unsafe { *confidence = score };
+    }
+    code
+}
+
 #[no_mangle]
 pub extern "C" fn opencc_last_error() -> *mut std::os::raw::c_char {
     let last_error = match OpenCC::get_last_error() {
@@ -194,6 +1104,243 @@ mod tests {
         );
     }
 
+    #[test]
+    fn test_opencc_convert_into() {
+        let opencc = OpenCC::new();
+        // Slice of a larger buffer, not NUL-terminated at input_len
+        let text = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。tail";
+        let input_len = text.len() - "tail".len();
+        let c_config = std::ffi::CString::new("s2twp").unwrap();
+        let expected = "義大利羅浮宮裡收藏的「蒙娜麗莎的微笑」畫像是曠世之作。";
+        let mut out_len = 0usize;
+        // Too small: reports the required size and writes nothing
+        let mut small = [0 as std::os::raw::c_char; 8];
+        let code = opencc_convert_into(
+            &opencc as *const OpenCC,
+            text.as_ptr() as *const std::os::raw::c_char,
+            input_len,
+            c_config.as_ptr(),
+            true,
+            small.as_mut_ptr(),
+            small.len(),
+            &mut out_len,
+        );
+        assert_eq!(code, 1);
+        assert_eq!(out_len, expected.len());
+        assert_eq!(small[0], 0);
+
+        let mut buf = vec![0 as std::os::raw::c_char; out_len + 1];
+        let code = opencc_convert_into(
+            &opencc as *const OpenCC,
+            text.as_ptr() as *const std::os::raw::c_char,
+            input_len,
+            c_config.as_ptr(),
+            true,
+            buf.as_mut_ptr(),
+            buf.len(),
+            &mut out_len,
+        );
+        assert_eq!(code, 0);
+        let result_str = unsafe { std::ffi::CStr::from_ptr(buf.as_ptr()) }
+            .to_str()
+            .unwrap();
+        assert_eq!(result_str, expected);
+        assert_eq!(out_len, expected.len());
+    }
+
+    #[test]
+    fn test_opencc_convert_batch() {
+        let opencc = OpenCC::new();
+        let texts = ["龙马精神", "", "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”"];
+        let inputs: Vec<*const std::os::raw::c_char> = texts
+            .iter()
+            .map(|text| text.as_ptr() as *const std::os::raw::c_char)
+            .collect();
+        let lens: Vec<usize> = texts.iter().map(|text| text.len()).collect();
+        let c_config = std::ffi::CString::new("s2twp").unwrap();
+        let batch = opencc_convert_batch(
+            &opencc as *const OpenCC,
+            inputs.as_ptr(),
+            lens.as_ptr(),
+            texts.len(),
+            c_config.as_ptr(),
+            true,
+        );
+        assert!(!batch.is_null());
+        let results: Vec<String> = unsafe {
+            let batch = &*batch;
+            (0..batch.count)
+                .map(|i| {
+                    let start = batch.data.add(*batch.offsets.add(i)) as *const u8;
+                    let bytes = std::slice::from_raw_parts(start, *batch.lengths.add(i));
+                    String::from_utf8(bytes.to_vec()).unwrap()
+                })
+                .collect()
+        };
+        opencc_batch_free(batch);
+        assert_eq!(
+            results,
+            ["龍馬精神", "", "義大利羅浮宮裡收藏的「蒙娜麗莎的微笑」"]
+        );
+    }
+
+    #[test]
+    fn test_opencc_converter_convert_batch() {
+        let opencc = OpenCC::new();
+        let c_config = std::ffi::CString::new("t2s").unwrap();
+        let converter = opencc_converter_new(&opencc as *const OpenCC, c_config.as_ptr(), false);
+        assert!(!converter.is_null());
+        let texts: Vec<std::ffi::CString> = ["龍馬精神", "漢字", "「名」"]
+            .iter()
+            .map(|text| std::ffi::CString::new(*text).unwrap())
+            .collect();
+        let inputs: Vec<*const std::os::raw::c_char> =
+            texts.iter().map(|text| text.as_ptr()).collect();
+        // Null lens: inputs are NUL-terminated
+        let batch = opencc_converter_convert_batch(
+            converter,
+            inputs.as_ptr(),
+            std::ptr::null(),
+            inputs.len(),
+        );
+        assert!(!batch.is_null());
+        let results: Vec<String> = unsafe {
+            let batch = &*batch;
+            (0..batch.count)
+                .map(|i| {
+                    let start = batch.data.add(*batch.offsets.add(i));
+                    std::ffi::CStr::from_ptr(start)
+                        .to_str()
+                        .unwrap()
+                        .to_string()
+                })
+                .collect()
+        };
+        opencc_batch_free(batch);
+        opencc_converter_free(converter);
+        assert_eq!(results, ["龙马精神", "汉字", "「名」"]);
+    }
+
+    #[test]
+    fn test_opencc_stream() {
+        let opencc = OpenCC::new();
+        let c_config = std::ffi::CString::new("s2twp").unwrap();
+        let stream = opencc_stream_new(&opencc as *const OpenCC, c_config.as_ptr(), true);
+        assert!(!stream.is_null());
+        let input = "“龙马精神”，意大利罗浮宫里收藏的蒙娜丽莎".as_bytes();
+        let mut output = Vec::new();
+        // Two-byte pieces split most characters across calls
+        for piece in input.chunks(2) {
+            let result = opencc_stream_feed(
+                stream,
+                piece.as_ptr() as *const std::os::raw::c_char,
+                piece.len(),
+            );
+            assert!(!result.is_null());
+            output.extend_from_slice(unsafe { std::ffi::CStr::from_ptr(result) }.to_bytes());
+            opencc_string_free(result);
+        }
+        let result = opencc_stream_finish(stream);
+        output.extend_from_slice(unsafe { std::ffi::CStr::from_ptr(result) }.to_bytes());
+        opencc_string_free(result);
+        opencc_stream_free(stream);
+        assert_eq!(
+            String::from_utf8(output).unwrap(),
+            "「龍馬精神」，義大利羅浮宮裡收藏的蒙娜麗莎"
+        );
+    }
+
+    #[test]
+    fn test_opencc_set_parallel_policy() {
+        let opencc = OpenCC::new();
+        let instance = &opencc as *const OpenCC;
+        assert_eq!(opencc_set_parallel_policy(instance, 0, 0, 0), 0);
+        assert_eq!(opencc_get_parallel(instance), false);
+        assert_eq!(opencc_set_parallel_policy(instance, 2, 1024, 2), 0);
+        assert_eq!(opencc_get_parallel(instance), true);
+        assert_eq!(opencc_set_parallel_policy(instance, 7, 0, 0), -1);
+        assert_eq!(opencc.s2t("龙马精神", false), "龍馬精神");
+    }
+
+    #[test]
+    fn test_opencc_new_shared() {
+        let first = opencc_new_shared();
+        let second = opencc_clone_handle(first);
+        opencc_set_parallel(second, false);
+        assert!(opencc_get_parallel(first));
+        assert!(!opencc_get_parallel(second));
+        assert!(std::sync::Arc::ptr_eq(
+            unsafe { (*first).dictionary() },
+            unsafe { (*second).dictionary() }
+        ));
+        opencc_free(first);
+        opencc_free(second);
+    }
+
+    #[test]
+    fn test_opencc_stats() {
+        let opencc = OpenCC::new();
+        let instance = &opencc as *const OpenCC;
+        let input = "龙马精神！汉字。";
+        let c_input = std::ffi::CString::new(input).unwrap();
+        let c_config = std::ffi::CString::new("s2twp").unwrap();
+        // Nothing is counted while disabled
+        let result = opencc_convert(instance, c_input.as_ptr(), c_config.as_ptr(), true);
+        opencc_string_free(result);
+        let stats = opencc_get_stats(instance);
+        assert_eq!(unsafe { (*stats).config_count }, 0);
+        opencc_stats_free(stats);
+
+        opencc_set_stats_enabled(instance, true);
+        let result = opencc_convert(instance, c_input.as_ptr(), c_config.as_ptr(), true);
+        let output_len = unsafe { std::ffi::CStr::from_ptr(result) }.to_bytes().len();
+        opencc_string_free(result);
+        let stats = opencc_get_stats(instance);
+        let config_stats = unsafe { &*(*stats).configs };
+        assert_eq!(unsafe { (*stats).config_count }, 1);
+        assert_eq!(
+            unsafe { std::ffi::CStr::from_ptr(config_stats.config) }.to_str(),
+            Ok("s2twp")
+        );
+        assert_eq!(config_stats.calls, 1);
+        assert_eq!(config_stats.bytes_in, input.len() as u64);
+        assert_eq!(config_stats.bytes_out, output_len as u64);
+        assert_eq!(config_stats.round_count, 3);
+        assert!(config_stats.rounds[0].hits > 0);
+        opencc_stats_free(stats);
+
+        opencc_reset_stats(instance);
+        let stats = opencc_get_stats(instance);
+        assert_eq!(unsafe { (*stats).config_count }, 0);
+        opencc_stats_free(stats);
+    }
+
+    #[test]
+    fn test_opencc_converter() {
+        let opencc = OpenCC::new();
+        let c_config = std::ffi::CString::new("S2TWP").unwrap();
+        let converter = opencc_converter_new(&opencc as *const OpenCC, c_config.as_ptr(), true);
+        assert!(!converter.is_null());
+
+        let input = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。";
+        let c_input = std::ffi::CString::new(input).unwrap();
+        for _ in 0..2 {
+            let result_ptr = opencc_converter_convert(converter, c_input.as_ptr());
+            let result_str = unsafe { std::ffi::CString::from_raw(result_ptr) }
+                .into_string()
+                .unwrap();
+            assert_eq!(
+                result_str,
+                "義大利羅浮宮裡收藏的「蒙娜麗莎的微笑」畫像是曠世之作。"
+            );
+        }
+        opencc_converter_free(converter);
+
+        let c_invalid = std::ffi::CString::new("s2s").unwrap();
+        let invalid = opencc_converter_new(&opencc as *const OpenCC, c_invalid.as_ptr(), false);
+        assert!(invalid.is_null());
+    }
+
     #[test]
     // If test_opencc_last_error_2 run first, this test will fail, it's expected
     fn test_opencc_last_error() {
@@ -236,4 +1383,196 @@ mod tests {
 
         assert_eq!(error_message, last_error_0);
     }
+
+    #[test]
+    fn test_opencc_new_with_configs() {
+        let names = [
+            std::ffi::CString::new("s2twp").unwrap(),
+            std::ffi::CString::new("auto2t").unwrap(),
+        ];
+        let configs: Vec<_> = names.iter().map(|name| name.as_ptr()).collect();
+        let instance = opencc_new_with_configs(configs.as_ptr(), configs.len());
+        assert!(!instance.is_null());
+        let c_input = std::ffi::CString::new("龙马精神").unwrap();
+        let result = opencc_convert(instance, c_input.as_ptr(), configs[0], false);
+        assert_eq!(
+            unsafe { std::ffi::CStr::from_ptr(result) }.to_str(),
+            Ok("龍馬精神")
+        );
+        opencc_string_free(result);
+        opencc_free(instance);
+
+        let invalid = std::ffi::CString::new("bogus").unwrap();
+        let configs = [configs[0], invalid.as_ptr()];
+        assert!(opencc_new_with_configs(configs.as_ptr(), configs.len()).is_null());
+    }
+
+    #[test]
+    fn test_opencc_cache() {
+        let opencc = OpenCC::new();
+        let instance = &opencc as *const OpenCC;
+        let c_input = std::ffi::CString::new("龙马精神").unwrap();
+        let c_config = std::ffi::CString::new("s2twp").unwrap();
+        opencc_set_cache(instance, 128, 64);
+        for _ in 0..3 {
+            let result = opencc_convert(instance, c_input.as_ptr(), c_config.as_ptr(), false);
+            opencc_string_free(result);
+        }
+        let mut stats = OpenccCacheStats {
+            hits: 0,
+            misses: 0,
+            entries: 0,
+            capacity: 0,
+        };
+        assert_eq!(opencc_get_cache_stats(instance, &mut stats), 0);
+        assert_eq!((stats.hits, stats.misses, stats.entries), (2, 1, 1));
+        assert_eq!(stats.capacity, 128);
+        assert_eq!(opencc_get_cache_stats(std::ptr::null(), &mut stats), -1);
+    }
+
+    #[test]
+    fn test_opencc_load_user_dict() {
+        let opencc = OpenCC::new();
+        let instance = &opencc as *const OpenCC;
+        let dir = std::env::temp_dir().join("opencc_fmmseg_capi_user_dict");
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("STPhrases.txt");
+        std::fs::write(&path, "龙马 龍馬仔\n").unwrap();
+        let c_path = std::ffi::CString::new(path.to_str().unwrap()).unwrap();
+        assert_eq!(opencc_load_user_dict(instance, c_path.as_ptr()), 0);
+        assert_eq!(opencc.s2t("龙马精神", false), "龍馬仔精神");
+        opencc_clear_user_dicts(instance);
+        assert_eq!(opencc.s2t("龙马精神", false), "龍馬精神");
+
+        let c_path = std::ffi::CString::new(dir.join("Unknown.txt").to_str().unwrap()).unwrap();
+        assert_eq!(opencc_load_user_dict(instance, c_path.as_ptr()), -1);
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn test_opencc_convert_with_spans() {
+        let opencc = OpenCC::new();
+        let instance = &opencc as *const OpenCC;
+        let c_input = std::ffi::CString::new("U盘和软件").unwrap();
+        let c_config = std::ffi::CString::new("s2twp").unwrap();
+        let mut count = 0;
+        let result = opencc_convert_with_spans(
+            instance,
+            c_input.as_ptr(),
+            c_config.as_ptr(),
+            false,
+            std::ptr::null_mut(),
+            0,
+            &mut count,
+        );
+        assert_eq!(count, 2);
+        opencc_string_free(result);
+
+        let mut spans: Vec<OpenccSpan> = (0..count)
+            .map(|_| OpenccSpan {
+                src_offset: 0,
+                src_len: 0,
+                dst_offset: 0,
+                dst_len: 0,
+            })
+            .collect();
+        let result = opencc_convert_with_spans(
+            instance,
+            c_input.as_ptr(),
+            c_config.as_ptr(),
+            false,
+            spans.as_mut_ptr(),
+            spans.len(),
+            &mut count,
+        );
+        assert_eq!(
+            unsafe { std::ffi::CStr::from_ptr(result) }.to_str(),
+            Ok("隨身碟和軟體")
+        );
+        opencc_string_free(result);
+        let last = &spans[1];
+        assert_eq!(
+            (last.src_offset, last.src_len, last.dst_offset, last.dst_len),
+            (7, 6, 12, 6)
+        );
+    }
+
+    extern "C" fn send_result(
+        user_data: *mut std::os::raw::c_void,
+        status: i32,
+        output: *mut std::os::raw::c_char,
+        _output_len: usize,
+    ) {
+        // Each task owns its sender, so it stays valid until the callback is done with it
+        let sender =
+            unsafe { Box::from_raw(user_data as *mut std::sync::mpsc::Sender<(i32, String)>) };
+        let text = if output.is_null() {
+            String::new()
+        } else {
+            let text = unsafe { std::ffi::CStr::from_ptr(output) }.to_string_lossy();
+            let text = text.into_owned();
+            opencc_string_free(output);
+            text
+        };
+        sender.send((status, text)).unwrap();
+    }
+
+    #[test]
+    fn test_opencc_convert_async() {
+        let instance = opencc_new();
+        let (sender, receiver) = std::sync::mpsc::channel::<(i32, String)>();
+        let c_config = std::ffi::CString::new("s2t").unwrap();
+        let input = "龙马精神";
+        let submit = || {
+            opencc_convert_async(
+                instance,
+                input.as_ptr() as *const std::os::raw::c_char,
+                input.len(),
+                c_config.as_ptr(),
+                false,
+                Some(send_result),
+                Box::into_raw(Box::new(sender.clone())) as *mut std::os::raw::c_void,
+            )
+        };
+
+        let task = submit();
+        assert!(!task.is_null());
+        assert_eq!(
+            receiver.recv().unwrap(),
+            (OPENCC_ASYNC_OK, "龍馬精神".to_string())
+        );
+        while opencc_async_pending(instance) > 0 {
+            std::thread::yield_now();
+        }
+        assert_eq!(opencc_async_status(task), 2);
+        assert_eq!(opencc_async_cancel(task), -1);
+        opencc_async_free(task);
+
+        // Whether the task is cancelled before it starts depends on the pool
+        let task = submit();
+        let expected = if opencc_async_cancel(task) == 0 {
+            (OPENCC_ASYNC_CANCELLED, String::new())
+        } else {
+            (OPENCC_ASYNC_OK, "龍馬精神".to_string())
+        };
+        opencc_async_free(task);
+        assert_eq!(receiver.recv().unwrap(), expected);
+
+        while opencc_async_pending(instance) > 0 {
+            std::thread::yield_now();
+        }
+        opencc_set_async_queue_limit(instance, 0);
+        assert!(submit().is_null());
+
+        // Pending tasks keep a freed instance alive until they finish
+        opencc_set_async_queue_limit(instance, 1);
+        let task = submit();
+        assert!(!task.is_null());
+        opencc_free(instance);
+        assert_eq!(
+            receiver.recv().unwrap(),
+            (OPENCC_ASYNC_OK, "龍馬精神".to_string())
+        );
+        opencc_async_free(task);
+    }
 }
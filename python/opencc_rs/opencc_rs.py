@@ -18,6 +18,15 @@ CONFIG_LIST = [
 ]
 
 
+class OpenccBatch(ctypes.Structure):
+    _fields_ = [
+        ("count", ctypes.c_size_t),
+        ("data", ctypes.c_void_p),
+        ("offsets", ctypes.POINTER(ctypes.c_size_t)),
+        ("lengths", ctypes.POINTER(ctypes.c_size_t)),
+    ]
+
+
 class OpenCC:
     def __init__(self, config=None):
         self.config = config if config in CONFIG_LIST else "s2t"
@@ -27,22 +36,84 @@ class OpenCC:
         # Define function prototypes
         self.lib.opencc_new.restype = ctypes.c_void_p
         self.lib.opencc_new.argtypes = []
-        self.lib.opencc_convert.restype = ctypes.c_char_p
+        # Results are returned as raw pointers so they can be released with opencc_string_free
+        self.lib.opencc_convert.restype = ctypes.c_void_p
         self.lib.opencc_convert.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_bool]
         self.lib.opencc_zho_check.restype = ctypes.c_int
         self.lib.opencc_zho_check.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
         self.lib.opencc_free.argtypes = [ctypes.c_void_p]
+        self.lib.opencc_string_free.argtypes = [ctypes.c_void_p]
+        # Batch entry points are bound on first use; older libraries do not export them
+        self._batch_functions = None
+        # One native instance per object, released in close() / __del__
+        self.opencc = self.lib.opencc_new()
+
+    def close(self):
+        if getattr(self, "opencc", None):
+            self.lib.opencc_free(self.opencc)
+            self.opencc = None
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
 
     def convert(self, text, punctuation=False):
-        opencc = self.lib.opencc_new()
-        if opencc is None:
+        if not self.opencc:
             return text
-        result = self.lib.opencc_convert(opencc, text.encode('utf-8'), self.config.encode('utf-8'), punctuation)
-        self.lib.opencc_free(opencc)
-        return result.decode('utf-8')
+        result = self.lib.opencc_convert(self.opencc, text.encode('utf-8'), self.config.encode('utf-8'), punctuation)
+        if not result:
+            return ""
+        try:
+            return ctypes.string_at(result).decode('utf-8')
+        finally:
+            self.lib.opencc_string_free(result)
+
+    def _batch_api(self):
+        if self._batch_functions is None:
+            try:
+                convert_batch = self.lib.opencc_convert_batch
+                batch_free = self.lib.opencc_batch_free
+            except AttributeError:
+                self._batch_functions = ()
+            else:
+                convert_batch.restype = ctypes.POINTER(OpenccBatch)
+                convert_batch.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p),
+                                          ctypes.POINTER(ctypes.c_size_t), ctypes.c_size_t,
+                                          ctypes.c_char_p, ctypes.c_bool]
+                batch_free.argtypes = [ctypes.POINTER(OpenccBatch)]
+                self._batch_functions = (convert_batch, batch_free)
+        return self._batch_functions
+
+    def convert_batch(self, texts, punctuation=False):
+        """Convert a list of strings with a single call into the native library."""
+        if not self.opencc:
+            return list(texts)
+        batch_api = self._batch_api()
+        if not batch_api:
+            return [self.convert(text, punctuation) for text in texts]
+        convert_batch, batch_free = batch_api
+        encoded = [text.encode('utf-8') for text in texts]
+        count = len(encoded)
+        if count == 0:
+            return []
+        inputs = (ctypes.c_char_p * count)(*encoded)
+        lens = (ctypes.c_size_t * count)(*[len(item) for item in encoded])
+        batch = convert_batch(self.opencc, inputs, lens, count, self.config.encode('utf-8'), punctuation)
+        if not batch:
+            return [""] * count
+        try:
+            result = batch.contents
+            return [ctypes.string_at(result.data + result.offsets[i], result.lengths[i]).decode('utf-8')
+                    for i in range(result.count)]
+        finally:
+            batch_free(batch)
 
     def zho_check(self, text):
-        opencc = self.lib.opencc_new()
-        code = self.lib.opencc_zho_check(opencc, text.encode('utf-8'))
-        self.lib.opencc_free(opencc)
-        return code
+        if not self.opencc:
+            return 0
+        return self.lib.opencc_zho_check(self.opencc, text.encode('utf-8'))
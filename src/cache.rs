@@ -0,0 +1,209 @@
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::hash::BuildHasher;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{OnceLock, RwLock};
+
+use crate::OpenccConfig;
+
+// Inputs of up to this many bytes are cached unless set_cache says otherwise
+pub const DEFAULT_CACHE_MAX_INPUT_BYTES: usize = 256;
+// Each shard has its own lock, picked by the key hash
+const SHARDS: usize = 16;
+
+// Snapshot of the conversion cache of one handle, see OpenCC::cache_stats
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct CacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub entries: usize,
+    pub capacity: usize,
+}
+
+impl CacheStats {
+    pub fn hit_rate(&self) -> f64 {
+        let lookups = self.hits + self.misses;
+        if lookups == 0 {
+            0.0
+        } else {
+            self.hits as f64 / lookups as f64
+        }
+    }
+}
+
+// Opt-in memo of whole conversions, keyed by CacheKey and the input. Shards are
+// allocated when the cache is first enabled; while it is off a conversion pays one
+// relaxed load. Hits only take a shard's read lock.
+pub(crate) struct ConversionCache {
+    // Longest input that is cached; 0 while the cache is off
+    max_input_bytes: AtomicUsize,
+    capacity: AtomicUsize,
+    hasher: RandomState,
+    shards: OnceLock<Box<[CacheShard]>>,
+}
+
+// Everything besides the input that determines a conversion's output
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) struct CacheKey {
+    pub(crate) config: OpenccConfig,
+    pub(crate) punctuation: bool,
+    // Generation of the user overlays the converter was built with, 0 for none
+    pub(crate) overlay: u64,
+}
+
+pub(crate) enum Lookup {
+    Uncached,
+    Hit,
+    // Not cached yet; pass the hash to insert
+    Miss(u64),
+}
+
+#[repr(align(128))]
+#[derive(Default)]
+struct CacheShard {
+    clock: RwLock<Clock>,
+    hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+// CLOCK replacement: a hit sets the slot's referenced bit, and eviction sweeps the
+// hand past referenced slots (clearing their bits) to the first unreferenced one
+#[derive(Default)]
+struct Clock {
+    capacity: usize,
+    slots: Vec<Slot>,
+    // Key hash -> slot; a colliding key simply replaces the slot
+    index: HashMap<u64, usize>,
+    hand: usize,
+}
+
+struct Slot {
+    hash: u64,
+    key: CacheKey,
+    input: Box<str>,
+    output: Box<str>,
+    referenced: AtomicBool,
+}
+
+impl ConversionCache {
+    pub(crate) fn new() -> Self {
+        ConversionCache {
+            max_input_bytes: AtomicUsize::new(0),
+            capacity: AtomicUsize::new(0),
+            hasher: RandomState::new(),
+            shards: OnceLock::new(),
+        }
+    }
+
+    // Cache up to `capacity` conversions of inputs of at most `max_input_bytes`; either
+    // being 0 turns the cache off. Drops every entry and zeroes the counters.
+    pub(crate) fn configure(&self, capacity: usize, max_input_bytes: usize) {
+        let enabled = capacity > 0 && max_input_bytes > 0;
+        self.max_input_bytes.store(0, Ordering::Relaxed);
+        if enabled || self.shards.get().is_some() {
+            let per_shard = capacity.div_ceil(SHARDS);
+            for shard in self.shards() {
+                let mut clock = shard.clock.write().unwrap();
+                *clock = Clock {
+                    capacity: if enabled { per_shard } else { 0 },
+                    ..Clock::default()
+                };
+                shard.hits.store(0, Ordering::Relaxed);
+                shard.misses.store(0, Ordering::Relaxed);
+            }
+        }
+        if enabled {
+            self.capacity.store(capacity, Ordering::Relaxed);
+            self.max_input_bytes
+                .store(max_input_bytes, Ordering::Relaxed);
+        } else {
+            self.capacity.store(0, Ordering::Relaxed);
+        }
+    }
+
+    // (capacity, max_input_bytes) as last configured
+    pub(crate) fn limits(&self) -> (usize, usize) {
+        (
+            self.capacity.load(Ordering::Relaxed),
+            self.max_input_bytes.load(Ordering::Relaxed),
+        )
+    }
+
+    // On a hit, `output` is replaced by the cached conversion
+    pub(crate) fn lookup(&self, key: CacheKey, input: &str, output: &mut String) -> Lookup {
+        let max_input_bytes = self.max_input_bytes.load(Ordering::Relaxed);
+        if max_input_bytes == 0 || input.len() > max_input_bytes {
+            return Lookup::Uncached;
+        }
+        let hash = self.hasher.hash_one((key, input));
+        let shard = self.shard(hash);
+        let clock = shard.clock.read().unwrap();
+        if let Some(slot) = clock.index.get(&hash).map(|&slot| &clock.slots[slot]) {
+            if slot.key == key && &*slot.input == input {
+                slot.referenced.store(true, Ordering::Relaxed);
+                output.clear();
+                output.push_str(&slot.output);
+                shard.hits.fetch_add(1, Ordering::Relaxed);
+                return Lookup::Hit;
+            }
+        }
+        shard.misses.fetch_add(1, Ordering::Relaxed);
+        Lookup::Miss(hash)
+    }
+
+    pub(crate) fn insert(&self, hash: u64, key: CacheKey, input: &str, output: &str) {
+        let mut clock = self.shard(hash).clock.write().unwrap();
+        let clock = &mut *clock;
+        if clock.capacity == 0 {
+            return;
+        }
+        let slot = Slot {
+            hash,
+            key,
+            input: input.into(),
+            output: output.into(),
+            referenced: AtomicBool::new(false),
+        };
+        if let Some(&index) = clock.index.get(&hash) {
+            clock.slots[index] = slot;
+        } else if clock.slots.len() < clock.capacity {
+            clock.index.insert(hash, clock.slots.len());
+            clock.slots.push(slot);
+        } else {
+            while clock.slots[clock.hand]
+                .referenced
+                .swap(false, Ordering::Relaxed)
+            {
+                clock.hand = (clock.hand + 1) % clock.slots.len();
+            }
+            let evicted = std::mem::replace(&mut clock.slots[clock.hand], slot);
+            clock.index.remove(&evicted.hash);
+            clock.index.insert(hash, clock.hand);
+            clock.hand = (clock.hand + 1) % clock.slots.len();
+        }
+    }
+
+    pub(crate) fn stats(&self) -> CacheStats {
+        let mut stats = CacheStats {
+            capacity: self.capacity.load(Ordering::Relaxed),
+            ..CacheStats::default()
+        };
+        let shards = self.shards.get().map_or(&[][..], |shards| &shards[..]);
+        for shard in shards {
+            stats.hits += shard.hits.load(Ordering::Relaxed);
+            stats.misses += shard.misses.load(Ordering::Relaxed);
+            stats.entries += shard.clock.read().unwrap().slots.len();
+        }
+        stats
+    }
+
+    fn shard(&self, hash: u64) -> &CacheShard {
+        // The low bits select the HashMap bucket, so pick the shard from the high ones
+        &self.shards()[(hash >> 60) as usize % SHARDS]
+    }
+
+    fn shards(&self) -> &[CacheShard] {
+        self.shards
+            .get_or_init(|| (0..SHARDS).map(|_| CacheShard::default()).collect())
+    }
+}
@@ -0,0 +1,131 @@
+use std::io;
+use std::sync::Arc;
+
+use super::trie::{Storage, Trie};
+use super::{DictId, DictionaryMaxlength};
+
+// Binary dictionary layout (all integers little-endian u32):
+//
+//   magic "OCFM", version, table_count
+//   table_count x [max_length, node_count, value_count, offset, length]
+//   serialized tries, each starting on a 4-byte boundary
+//
+// Tables follow DictId::ALL order. Tries are queried directly inside the buffer, so
+// nothing is deserialized: loading only reads the directory, and each table is
+// validated the first time it is used.
+const MAGIC: &[u8; 4] = b"OCFM";
+const VERSION: u32 = 1;
+const HEADER_WORDS: usize = 3;
+const ENTRY_WORDS: usize = 5;
+
+pub(crate) fn to_binary(dictionary: &DictionaryMaxlength) -> Vec<u8> {
+    let tries: Vec<&Trie> = DictId::ALL.iter().map(|&id| dictionary.trie(id)).collect();
+    let mut offset = 4 * (HEADER_WORDS + ENTRY_WORDS * tries.len());
+    let mut directory = Vec::with_capacity(tries.len());
+    for trie in &tries {
+        let length = trie.as_bytes().len();
+        directory.push((offset, length));
+        offset = align4(offset + length);
+    }
+
+    let mut bytes = Vec::with_capacity(offset);
+    bytes.extend_from_slice(MAGIC);
+    push_word(&mut bytes, VERSION);
+    push_word(&mut bytes, tries.len() as u32);
+    for (trie, (offset, length)) in tries.iter().zip(&directory) {
+        push_word(&mut bytes, trie.max_length() as u32);
+        push_word(&mut bytes, trie.node_count() as u32);
+        push_word(&mut bytes, trie.value_count() as u32);
+        push_word(&mut bytes, *offset as u32);
+        push_word(&mut bytes, *length as u32);
+    }
+    for trie in &tries {
+        bytes.extend_from_slice(trie.as_bytes());
+        bytes.resize(align4(bytes.len()), 0);
+    }
+
+    bytes
+}
+
+// Directory of a loaded binary dictionary
+pub(crate) struct BinaryTables {
+    storage: Arc<Storage>,
+    entries: Vec<TableEntry>,
+}
+
+struct TableEntry {
+    max_length: usize,
+    node_count: usize,
+    value_count: usize,
+    offset: usize,
+    length: usize,
+}
+
+impl BinaryTables {
+    pub(crate) fn max_length(&self, table: usize) -> usize {
+        self.entries[table].max_length
+    }
+
+    // Validate one table and view it as a trie
+    pub(crate) fn load(&self, table: usize) -> io::Result<Trie> {
+        let entry = &self.entries[table];
+        Trie::from_storage(
+            Arc::clone(&self.storage),
+            entry.offset,
+            entry.length,
+            entry.node_count,
+            entry.value_count,
+            entry.max_length,
+        )
+    }
+}
+
+pub(crate) fn from_binary(storage: Storage) -> io::Result<BinaryTables> {
+    let invalid = |msg: &str| io::Error::new(io::ErrorKind::InvalidData, msg.to_string());
+    let storage = Arc::new(storage);
+    let bytes = storage.as_slice();
+    if bytes.len() < 4 * HEADER_WORDS || &bytes[..4] != MAGIC {
+        return Err(invalid("not an opencc-fmmseg binary dictionary"));
+    }
+    if read_word(bytes, 1) != VERSION {
+        return Err(invalid("unsupported binary dictionary version"));
+    }
+    let table_count = read_word(bytes, 2) as usize;
+    if table_count != DictId::ALL.len()
+        || bytes.len() < 4 * (HEADER_WORDS + ENTRY_WORDS * table_count)
+    {
+        return Err(invalid("binary dictionary directory is truncated"));
+    }
+
+    let entries = (0..table_count)
+        .map(|table| {
+            let entry = HEADER_WORDS + ENTRY_WORDS * table;
+            let entry = TableEntry {
+                max_length: read_word(bytes, entry) as usize,
+                node_count: read_word(bytes, entry + 1) as usize,
+                value_count: read_word(bytes, entry + 2) as usize,
+                offset: read_word(bytes, entry + 3) as usize,
+                length: read_word(bytes, entry + 4) as usize,
+            };
+            if entry.offset.saturating_add(entry.length) > bytes.len() {
+                return Err(invalid("binary dictionary table out of range"));
+            }
+            Ok(entry)
+        })
+        .collect::<io::Result<_>>()?;
+
+    Ok(BinaryTables { storage, entries })
+}
+
+fn align4(n: usize) -> usize {
+    (n + 3) & !3
+}
+
+fn push_word(bytes: &mut Vec<u8>, word: u32) {
+    bytes.extend_from_slice(&word.to_le_bytes());
+}
+
+fn read_word(bytes: &[u8], index: usize) -> u32 {
+    let at = 4 * index;
+    u32::from_le_bytes([bytes[at], bytes[at + 1], bytes[at + 2], bytes[at + 3]])
+}
@@ -1,13 +1,22 @@
+use std::cell::RefCell;
 use std::collections::HashMap;
 use std::error::Error;
 use std::fs::File;
 use std::io::Write;
-use std::sync::Mutex;
+use std::sync::OnceLock;
 use std::{fs, io};
 
+use rayon::prelude::*;
 use serde::{Deserialize, Serialize};
-// Define a global mutable variable to store the error message
-static LAST_ERROR: Mutex<Option<String>> = Mutex::new(None);
+
+pub use trie::Trie;
+
+mod binary;
+mod trie;
+thread_local! {
+    // Last error message of the calling thread
+    static LAST_ERROR: RefCell<Option<String>> = RefCell::new(None);
+}
 
 #[derive(Serialize, Deserialize)]
 pub struct DictionaryMaxlength {
@@ -27,6 +36,122 @@ pub struct DictionaryMaxlength {
     pub jps_phrases: (HashMap<String, String>, usize),
     pub jp_variants: (HashMap<String, String>, usize),
     pub jp_variants_rev: (HashMap<String, String>, usize),
+    // Lookup tries, built on first use of each table; a table that fails to load keeps
+    // its error instead
+    #[serde(skip)]
+    tries: [OnceLock<Result<Trie, String>>; 16],
+    // One trie per entry of MERGED_ROUNDS, built the first time a config uses it
+    #[serde(skip)]
+    merged_tries: [OnceLock<Trie>; 5],
+    // Source of the tries of a binary-loaded dictionary
+    #[serde(skip)]
+    binary: Option<binary::BinaryTables>,
+}
+
+// Identifies one of the sixteen dictionary tables
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum DictId {
+    StCharacters,
+    StPhrases,
+    TsCharacters,
+    TsPhrases,
+    TwPhrases,
+    TwPhrasesRev,
+    TwVariants,
+    TwVariantsRev,
+    TwVariantsRevPhrases,
+    HkVariants,
+    HkVariantsRev,
+    HkVariantsRevPhrases,
+    JpsCharacters,
+    JpsPhrases,
+    JpVariants,
+    JpVariantsRev,
+}
+
+// Text sources of the tables, in DictId::ALL order
+const DICT_SOURCES: [&str; 16] = [
+    include_str!("dicts/STCharacters.txt"),
+    include_str!("dicts/STPhrases.txt"),
+    include_str!("dicts/TSCharacters.txt"),
+    include_str!("dicts/TSPhrases.txt"),
+    include_str!("dicts/TWPhrases.txt"),
+    include_str!("dicts/TWPhrasesRev.txt"),
+    include_str!("dicts/TWVariants.txt"),
+    include_str!("dicts/TWVariantsRev.txt"),
+    include_str!("dicts/TWVariantsRevPhrases.txt"),
+    include_str!("dicts/HKVariants.txt"),
+    include_str!("dicts/HKVariantsRev.txt"),
+    include_str!("dicts/HKVariantsRevPhrases.txt"),
+    include_str!("dicts/JPShinjitaiCharacters.txt"),
+    include_str!("dicts/JPShinjitaiPhrases.txt"),
+    include_str!("dicts/JPVariants.txt"),
+    include_str!("dicts/JPVariantsRev.txt"),
+];
+
+// Multi-table rounds of the built-in configs, in lookup priority order. Each is served
+// by a single merged trie instead of a probe per table.
+const MERGED_ROUNDS: [&[DictId]; 5] = [
+    &[DictId::StPhrases, DictId::StCharacters],
+    &[DictId::TsPhrases, DictId::TsCharacters],
+    &[DictId::TwVariantsRevPhrases, DictId::TwVariantsRev],
+    &[DictId::HkVariantsRevPhrases, DictId::HkVariantsRev],
+    &[
+        DictId::JpsPhrases,
+        DictId::JpsCharacters,
+        DictId::JpVariantsRev,
+    ],
+];
+
+impl DictId {
+    pub const ALL: [DictId; 16] = [
+        DictId::StCharacters,
+        DictId::StPhrases,
+        DictId::TsCharacters,
+        DictId::TsPhrases,
+        DictId::TwPhrases,
+        DictId::TwPhrasesRev,
+        DictId::TwVariants,
+        DictId::TwVariantsRev,
+        DictId::TwVariantsRevPhrases,
+        DictId::HkVariants,
+        DictId::HkVariantsRev,
+        DictId::HkVariantsRevPhrases,
+        DictId::JpsCharacters,
+        DictId::JpsPhrases,
+        DictId::JpVariants,
+        DictId::JpVariantsRev,
+    ];
+
+    // Name of the table's source file under dicts/, e.g. "STPhrases.txt"
+    pub fn file_name(self) -> &'static str {
+        match self {
+            DictId::StCharacters => "STCharacters.txt",
+            DictId::StPhrases => "STPhrases.txt",
+            DictId::TsCharacters => "TSCharacters.txt",
+            DictId::TsPhrases => "TSPhrases.txt",
+            DictId::TwPhrases => "TWPhrases.txt",
+            DictId::TwPhrasesRev => "TWPhrasesRev.txt",
+            DictId::TwVariants => "TWVariants.txt",
+            DictId::TwVariantsRev => "TWVariantsRev.txt",
+            DictId::TwVariantsRevPhrases => "TWVariantsRevPhrases.txt",
+            DictId::HkVariants => "HKVariants.txt",
+            DictId::HkVariantsRev => "HKVariantsRev.txt",
+            DictId::HkVariantsRevPhrases => "HKVariantsRevPhrases.txt",
+            DictId::JpsCharacters => "JPShinjitaiCharacters.txt",
+            DictId::JpsPhrases => "JPShinjitaiPhrases.txt",
+            DictId::JpVariants => "JPVariants.txt",
+            DictId::JpVariantsRev => "JPVariantsRev.txt",
+        }
+    }
+
+    // Table whose source file name is `file_name`, with or without the ".txt"
+    pub fn from_file_name(file_name: &str) -> Option<DictId> {
+        let stem = file_name.strip_suffix(".txt").unwrap_or(file_name);
+        DictId::ALL
+            .into_iter()
+            .find(|id| id.file_name().strip_suffix(".txt") == Some(stem))
+    }
 }
 
 impl DictionaryMaxlength {
@@ -43,67 +168,182 @@ impl DictionaryMaxlength {
         Ok(dictionary)
     }
 
+    // Parse the text dictionaries under dicts/, one table per rayon task
     pub fn from_dicts() -> Self {
-        let stc_file_path = include_str!("dicts/STCharacters.txt");
-        let stp_file_path = include_str!("dicts/STPhrases.txt");
-        let tsc_file_path = include_str!("dicts/TSCharacters.txt");
-        let tsp_file_path = include_str!("dicts/TSPhrases.txt");
-        let twp_file_path = include_str!("dicts/TWPhrases.txt");
-        let twpr_file_path = include_str!("dicts/TWPhrasesRev.txt");
-        let twv_file_path = include_str!("dicts/TWVariants.txt");
-        let twvr_file_path = include_str!("dicts/TWVariantsRev.txt");
-        let twvrp_file_path = include_str!("dicts/TWVariantsRevPhrases.txt");
-        let hkv_file_path = include_str!("dicts/HKVariants.txt");
-        let hkvr_file_path = include_str!("dicts/HKVariantsRev.txt");
-        let hkvrp_file_path = include_str!("dicts/HKVariantsRevPhrases.txt");
-        let jpsc_file_path = include_str!("dicts/JPShinjitaiCharacters.txt");
-        let jpsp_file_path = include_str!("dicts/JPShinjitaiPhrases.txt");
-        let jpv_file_path = include_str!("dicts/JPVariants.txt");
-        let jpvr_file_path = include_str!("dicts/JPVariantsRev.txt");
-        let st_characters = DictionaryMaxlength::load_dictionary_maxlength(stc_file_path).unwrap();
-        let st_phrases = DictionaryMaxlength::load_dictionary_maxlength(stp_file_path).unwrap();
-        let ts_characters = DictionaryMaxlength::load_dictionary_maxlength(tsc_file_path).unwrap();
-        let ts_phrases = DictionaryMaxlength::load_dictionary_maxlength(tsp_file_path).unwrap();
-        let tw_phrases = DictionaryMaxlength::load_dictionary_maxlength(twp_file_path).unwrap();
-        let tw_phrases_rev =
-            DictionaryMaxlength::load_dictionary_maxlength(twpr_file_path).unwrap();
-        let tw_variants = DictionaryMaxlength::load_dictionary_maxlength(twv_file_path).unwrap();
-        let tw_variants_rev =
-            DictionaryMaxlength::load_dictionary_maxlength(twvr_file_path).unwrap();
-        let tw_variants_rev_phrases =
-            DictionaryMaxlength::load_dictionary_maxlength(twvrp_file_path).unwrap();
-        let hk_variants = DictionaryMaxlength::load_dictionary_maxlength(hkv_file_path).unwrap();
-        let hk_variants_rev =
-            DictionaryMaxlength::load_dictionary_maxlength(hkvr_file_path).unwrap();
-        let hk_variants_rev_phrases =
-            DictionaryMaxlength::load_dictionary_maxlength(hkvrp_file_path).unwrap();
-        let jps_characters =
-            DictionaryMaxlength::load_dictionary_maxlength(jpsc_file_path).unwrap();
-        let jps_phrases = DictionaryMaxlength::load_dictionary_maxlength(jpsp_file_path).unwrap();
-        let jp_variants = DictionaryMaxlength::load_dictionary_maxlength(jpv_file_path).unwrap();
-        let jp_variants_rev =
-            DictionaryMaxlength::load_dictionary_maxlength(jpvr_file_path).unwrap();
-
-        DictionaryMaxlength {
-            st_characters,
-            st_phrases,
-            ts_characters,
-            ts_phrases,
-            tw_phrases,
-            tw_phrases_rev,
-            tw_variants,
-            tw_variants_rev,
-            tw_variants_rev_phrases,
-            hk_variants,
-            hk_variants_rev,
-            hk_variants_rev_phrases,
-            jps_characters,
-            jps_phrases,
-            jp_variants,
-            jp_variants_rev,
+        let tables: Vec<_> = DICT_SOURCES
+            .par_iter()
+            .map(|content| DictionaryMaxlength::load_dictionary_maxlength(content).unwrap())
+            .collect();
+        let mut dictionary = DictionaryMaxlength::default();
+        for (id, table) in DictId::ALL.into_iter().zip(tables) {
+            *dictionary.table_mut(id) = table;
+        }
+
+        dictionary
+    }
+
+    pub fn table(&self, id: DictId) -> &(HashMap<String, String>, usize) {
+        match id {
+            DictId::StCharacters => &self.st_characters,
+            DictId::StPhrases => &self.st_phrases,
+            DictId::TsCharacters => &self.ts_characters,
+            DictId::TsPhrases => &self.ts_phrases,
+            DictId::TwPhrases => &self.tw_phrases,
+            DictId::TwPhrasesRev => &self.tw_phrases_rev,
+            DictId::TwVariants => &self.tw_variants,
+            DictId::TwVariantsRev => &self.tw_variants_rev,
+            DictId::TwVariantsRevPhrases => &self.tw_variants_rev_phrases,
+            DictId::HkVariants => &self.hk_variants,
+            DictId::HkVariantsRev => &self.hk_variants_rev,
+            DictId::HkVariantsRevPhrases => &self.hk_variants_rev_phrases,
+            DictId::JpsCharacters => &self.jps_characters,
+            DictId::JpsPhrases => &self.jps_phrases,
+            DictId::JpVariants => &self.jp_variants,
+            DictId::JpVariantsRev => &self.jp_variants_rev,
+        }
+    }
+
+    fn table_mut(&mut self, id: DictId) -> &mut (HashMap<String, String>, usize) {
+        match id {
+            DictId::StCharacters => &mut self.st_characters,
+            DictId::StPhrases => &mut self.st_phrases,
+            DictId::TsCharacters => &mut self.ts_characters,
+            DictId::TsPhrases => &mut self.ts_phrases,
+            DictId::TwPhrases => &mut self.tw_phrases,
+            DictId::TwPhrasesRev => &mut self.tw_phrases_rev,
+            DictId::TwVariants => &mut self.tw_variants,
+            DictId::TwVariantsRev => &mut self.tw_variants_rev,
+            DictId::TwVariantsRevPhrases => &mut self.tw_variants_rev_phrases,
+            DictId::HkVariants => &mut self.hk_variants,
+            DictId::HkVariantsRev => &mut self.hk_variants_rev,
+            DictId::HkVariantsRevPhrases => &mut self.hk_variants_rev_phrases,
+            DictId::JpsCharacters => &mut self.jps_characters,
+            DictId::JpsPhrases => &mut self.jps_phrases,
+            DictId::JpVariants => &mut self.jp_variants,
+            DictId::JpVariantsRev => &mut self.jp_variants_rev,
         }
     }
 
+    // Longest-match trie for a table, built (or for a binary dictionary, validated) the
+    // first time it is requested. A binary table that fails validation reads as empty
+    // and sets the OpenCC last error (the one conversions report through) on every
+    // request; use preload to get the error instead.
+    pub fn trie(&self, id: DictId) -> &Trie {
+        self.load_trie(id).unwrap_or_else(|err| {
+            crate::OpenCC::set_last_error(&format!("Failed to load dictionary table: {}", err));
+            static EMPTY_TRIE: OnceLock<Trie> = OnceLock::new();
+            EMPTY_TRIE.get_or_init(|| Trie::from_dictionary(&(HashMap::new(), 1)))
+        })
+    }
+
+    fn load_trie(&self, id: DictId) -> Result<&Trie, &str> {
+        let loaded = self.tries[id as usize].get_or_init(|| match &self.binary {
+            Some(binary) => binary.load(id as usize).map_err(|err| err.to_string()),
+            None => Ok(Trie::from_dictionary(self.table(id))),
+        });
+        loaded.as_ref().map_err(String::as_str)
+    }
+
+    // Make the tries of `ids` ready now rather than on first use. Fails, every time it
+    // is asked, for a table that does not load.
+    pub fn preload(&self, ids: &[DictId]) -> io::Result<()> {
+        for &id in ids {
+            if let Err(err) = self.load_trie(id) {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    format!("Failed to load dictionary table: {}", err),
+                ));
+            }
+        }
+        Ok(())
+    }
+
+    // Tries that answer a round of tables: the cached merged trie when the round is one
+    // of MERGED_ROUNDS, otherwise the trie of each table. Tables that fail to load read
+    // as empty and set the last error, as with trie.
+    pub fn round_tries(&self, ids: &[DictId]) -> Vec<&Trie> {
+        let tries: Vec<&Trie> = ids.iter().map(|&id| self.trie(id)).collect();
+        match MERGED_ROUNDS.iter().position(|round| *round == ids) {
+            Some(index) => vec![self.merged_tries[index].get_or_init(|| Trie::merged(&tries))],
+            None => tries,
+        }
+    }
+
+    // Load the binary dictionary embedded in the library; tables are queried in place
+    pub fn from_embedded_binary() -> io::Result<Self> {
+        Self::from_static_binary(include_bytes!("dicts/dictionary_maxlength.bin"))
+    }
+
+    pub fn from_static_binary(bytes: &'static [u8]) -> io::Result<Self> {
+        Self::from_storage(trie::Storage::Static(bytes))
+    }
+
+    // Memory-map a file written by serialize_to_binary. Like every binary-loaded
+    // dictionary, only the lookup tries and max lengths are populated; the HashMap
+    // tables are empty until load_tables fills them.
+    pub fn from_binary(filename: &str) -> io::Result<Self> {
+        let file = match File::open(filename) {
+            Ok(f) => f,
+            Err(err) => {
+                Self::set_last_error(&format!("Failed to open binary dictionary: {}", err));
+                return Err(err);
+            }
+        };
+        // SAFETY: the mapping is read-only and validated before use; the file must not
+        // be truncated while mapped
+        let mmap = match unsafe { memmap2::Mmap::map(&file) } {
+            Ok(m) => m,
+            Err(err) => {
+                Self::set_last_error(&format!("Failed to map binary dictionary: {}", err));
+                return Err(err);
+            }
+        };
+        Self::from_storage(trie::Storage::Mapped(mmap))
+    }
+
+    fn from_storage(storage: trie::Storage) -> io::Result<Self> {
+        let binary = match binary::from_binary(storage) {
+            Ok(binary) => binary,
+            Err(err) => {
+                Self::set_last_error(&format!("Failed to load binary dictionary: {}", err));
+                return Err(err);
+            }
+        };
+        let mut dictionary = DictionaryMaxlength::default();
+        for id in DictId::ALL {
+            dictionary.table_mut(id).1 = binary.max_length(id as usize);
+        }
+        dictionary.binary = Some(binary);
+
+        Ok(dictionary)
+    }
+
+    // Fill the HashMap tables of a binary-loaded dictionary from its tries, for callers
+    // that read the maps. Dictionaries loaded from text or JSON already have them.
+    pub fn load_tables(&mut self) -> io::Result<()> {
+        if self.binary.is_some() {
+            let tables = self.tables_from_tries()?;
+            for (id, entries) in DictId::ALL.into_iter().zip(tables) {
+                self.table_mut(id).0 = entries;
+            }
+        }
+        Ok(())
+    }
+
+    fn tables_from_tries(&self) -> io::Result<Vec<HashMap<String, String>>> {
+        self.preload(&DictId::ALL)?;
+        let tables = DictId::ALL
+            .par_iter()
+            .map(|&id| {
+                let entries = self.trie(id).entries().into_iter();
+                entries
+                    .map(|(key, value)| (key, value.to_string()))
+                    .collect()
+            })
+            .collect();
+        Ok(tables)
+    }
+
     #[allow(dead_code)]
     pub fn from_json(filename: &str) -> io::Result<Self> {
         // Read the contents of the JSON file
@@ -126,34 +366,44 @@ impl DictionaryMaxlength {
         Ok(dictionary)
     }
 
-    fn load_dictionary_maxlength(
+    pub(crate) fn load_dictionary_maxlength(
         dictionary_content: &str,
     ) -> io::Result<(HashMap<String, String>, usize)> {
-        let mut dictionary = HashMap::new();
+        let lines = dictionary_content.bytes().filter(|&b| b == b'\n').count() + 1;
+        let mut dictionary = HashMap::with_capacity(lines);
         let mut max_length: usize = 1;
 
         for line in dictionary_content.lines() {
-            let parts: Vec<&str> = line.split_whitespace().collect();
-            if parts.len() >= 2 {
-                let phrase = parts[0].to_string();
-                let translation = parts[1].to_string();
-                let char_count = phrase.chars().count();
-                if max_length < char_count {
-                    max_length = char_count;
+            let mut parts = line.split_whitespace();
+            match (parts.next(), parts.next()) {
+                (Some(phrase), Some(translation)) => {
+                    // A phrase has at most as many chars as bytes, so only count the
+                    // chars of phrases that could be longer than the current maximum
+                    if phrase.len() > max_length {
+                        max_length = max_length.max(phrase.chars().count());
+                    }
+                    dictionary.insert(phrase.to_string(), translation.to_string());
                 }
-                dictionary.insert(phrase, translation);
-            } else {
-                eprintln!("Invalid line format: {}", line);
+                _ => eprintln!("Invalid line format: {}", line),
             }
         }
 
         Ok((dictionary, max_length))
     }
 
-    // Function to serialize Dictionary to JSON and write it to a file
+    // Function to serialize Dictionary to JSON and write it to a file. The tables of a
+    // binary-loaded dictionary are rebuilt from its tries first.
     pub fn serialize_to_json(&self, filename: &str) -> io::Result<()> {
+        let mut rebuilt = None;
+        if self.binary.is_some() && self.st_characters.0.is_empty() {
+            let mut dictionary = DictionaryMaxlength::default();
+            for (id, entries) in DictId::ALL.into_iter().zip(self.tables_from_tries()?) {
+                *dictionary.table_mut(id) = (entries, self.table(id).1);
+            }
+            rebuilt = Some(dictionary);
+        }
         // Serialize the Dictionary to JSON
-        let json_string = match serde_json::to_string(&self) {
+        let json_string = match serde_json::to_string(rebuilt.as_ref().unwrap_or(self)) {
             Ok(json) => json,
             Err(err) => {
                 Self::set_last_error(&format!("Failed to serialize JSON: {}", err));
@@ -177,16 +427,37 @@ impl DictionaryMaxlength {
         Ok(())
     }
 
+    // Serialize the lookup tries into the binary dictionary format
+    pub fn to_binary(&self) -> Vec<u8> {
+        binary::to_binary(self)
+    }
+
+    // Function to serialize Dictionary to the binary format and write it to a file
+    pub fn serialize_to_binary(&self, filename: &str) -> io::Result<()> {
+        let mut file = match File::create(filename) {
+            Ok(f) => f,
+            Err(err) => {
+                Self::set_last_error(&format!("Failed to create file: {}", err));
+                return Err(err);
+            }
+        };
+
+        if let Err(err) = file.write_all(&self.to_binary()) {
+            Self::set_last_error(&format!("Failed to write to file: {}", err));
+            return Err(err);
+        }
+
+        Ok(())
+    }
+
     // Function to set the last error message
     pub fn set_last_error(err_msg: &str) {
-        let mut last_error = LAST_ERROR.lock().unwrap();
-        *last_error = Some(err_msg.to_string());
+        LAST_ERROR.with(|last_error| *last_error.borrow_mut() = Some(err_msg.to_string()));
     }
 
     // Function to retrieve the last error message
     pub fn get_last_error() -> Option<String> {
-        let last_error = LAST_ERROR.lock().unwrap();
-        last_error.clone()
+        LAST_ERROR.with(|last_error| last_error.borrow().clone())
     }
 }
 
@@ -209,6 +480,9 @@ impl Default for DictionaryMaxlength {
             jps_phrases: (HashMap::new(), 0),
             jp_variants: (HashMap::new(), 0),
             jp_variants_rev: (HashMap::new(), 0),
+            tries: Default::default(),
+            merged_tries: Default::default(),
+            binary: None,
         }
     }
 }
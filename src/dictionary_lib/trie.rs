@@ -0,0 +1,429 @@
+use std::collections::{HashMap, VecDeque};
+use std::io;
+use std::sync::{Arc, OnceLock};
+
+use crate::scan::CharSet;
+
+// Character-level prefix trie over one dictionary table, used for allocation-free
+// longest-match lookups straight off the input &str.
+//
+// Nodes are laid out breadth-first so the children of node `i` are the contiguous
+// range `first_child[i]..first_child[i + 1]`, sorted by label. Everything lives in a
+// single little-endian byte buffer, which is also the on-disk form used by the
+// binary dictionary format:
+//
+//   labels:        node_count u32      (codepoint of the edge into each node)
+//   first_child:   node_count + 1 u32
+//   values:        node_count u32      (value index + 1, 0 when the node ends no key)
+//   value_offsets: value_count + 1 u32 (byte ranges into the pool)
+//   pool:          pool_len bytes of UTF-8
+pub struct Trie {
+    storage: Arc<Storage>,
+    start: usize,
+    len: usize,
+    node_count: usize,
+    value_count: usize,
+    max_length: usize,
+    // First chars of all keys, chars of keys longer than one char, and one-char keys
+    // mapped to something else, built on first use
+    starters: OnceLock<CharSet>,
+    multi_char_key_chars: OnceLock<CharSet>,
+    remapped_chars: OnceLock<CharSet>,
+    // Codepoint-indexed first step of every lookup, built on first use
+    root_index: OnceLock<RootIndex>,
+}
+
+// Two-level table from a codepoint to the root child labelled with it, replacing the
+// binary search over the root's children. For one-char tables such as st_characters
+// that is the entire lookup. Pages of 256 codepoints without any child share page 0;
+// a slot holds the child node, or 0 for none (the root is nobody's child).
+struct RootIndex {
+    pages: Box<[u16; 0x1100]>,
+    nodes: Vec<[u32; 256]>,
+}
+
+impl RootIndex {
+    fn new(children: impl Iterator<Item = (u32, u32)>) -> Self {
+        let mut index = RootIndex {
+            pages: Box::new([0; 0x1100]),
+            nodes: vec![[0; 256]],
+        };
+        for (label, node) in children {
+            let page = &mut index.pages[label as usize >> 8];
+            if *page == 0 {
+                *page = index.nodes.len() as u16;
+                index.nodes.push([0; 256]);
+            }
+            index.nodes[*page as usize][label as usize & 0xFF] = node;
+        }
+        index
+    }
+
+    #[inline]
+    fn get(&self, ch: char) -> Option<usize> {
+        let code = ch as usize;
+        let node = self.nodes[self.pages[code >> 8] as usize][code & 0xFF];
+        (node != 0).then_some(node as usize)
+    }
+}
+
+// Memory a trie reads from: its own buffer, or a region of a binary dictionary that
+// is embedded in the executable or memory-mapped from disk
+pub(crate) enum Storage {
+    Owned(Vec<u8>),
+    Static(&'static [u8]),
+    Mapped(memmap2::Mmap),
+}
+
+impl Storage {
+    pub(crate) fn as_slice(&self) -> &[u8] {
+        match self {
+            Storage::Owned(bytes) => bytes,
+            Storage::Static(bytes) => bytes,
+            Storage::Mapped(mmap) => mmap,
+        }
+    }
+}
+
+impl Trie {
+    pub fn from_dictionary(dictionary: &(HashMap<String, String>, usize)) -> Self {
+        let mut keys: Vec<(Vec<char>, &str)> = dictionary
+            .0
+            .iter()
+            .map(|(key, value)| (key.chars().collect(), value.as_str()))
+            .collect();
+        keys.sort_unstable_by(|a, b| a.0.cmp(&b.0));
+
+        let mut labels: Vec<u32> = vec![0];
+        let mut values: Vec<u32> = vec![0];
+        let mut first_child: Vec<u32> = Vec::new();
+        let mut value_offsets: Vec<u32> = vec![0];
+        let mut value_indexes: HashMap<&str, u32> = HashMap::new();
+        let mut pool = String::new();
+
+        // Root holds the empty key, which never matches
+        let mut queue = VecDeque::new();
+        queue.push_back((0, keys.len(), 0));
+        while let Some((start, end, depth)) = queue.pop_front() {
+            first_child.push(labels.len() as u32);
+            let mut i = start;
+            if i < end && keys[i].0.len() == depth {
+                i += 1;
+            }
+            while i < end {
+                let label = keys[i].0[depth];
+                let mut j = i + 1;
+                while j < end && keys[j].0[depth] == label {
+                    j += 1;
+                }
+                labels.push(label as u32);
+                // Keys are sorted, so a key ending at this node comes first in its group
+                if keys[i].0.len() == depth + 1 {
+                    let value = keys[i].1;
+                    let index = *value_indexes.entry(value).or_insert_with(|| {
+                        pool.push_str(value);
+                        value_offsets.push(pool.len() as u32);
+                        (value_offsets.len() - 2) as u32
+                    });
+                    values.push(index + 1);
+                } else {
+                    values.push(0);
+                }
+                queue.push_back((i, j, depth + 1));
+                i = j;
+            }
+        }
+        first_child.push(labels.len() as u32);
+
+        let node_count = labels.len();
+        let value_count = value_offsets.len() - 1;
+        let mut bytes = Vec::with_capacity(4 * (node_count * 3 + 1 + value_count + 1) + pool.len());
+        for word in labels
+            .iter()
+            .chain(first_child.iter())
+            .chain(values.iter())
+            .chain(value_offsets.iter())
+        {
+            bytes.extend_from_slice(&word.to_le_bytes());
+        }
+        bytes.extend_from_slice(pool.as_bytes());
+
+        Trie {
+            len: bytes.len(),
+            storage: Arc::new(Storage::Owned(bytes)),
+            start: 0,
+            node_count,
+            value_count,
+            max_length: dictionary.1,
+            starters: OnceLock::new(),
+            multi_char_key_chars: OnceLock::new(),
+            remapped_chars: OnceLock::new(),
+            root_index: OnceLock::new(),
+        }
+    }
+
+    // One trie with the keys of all `tries`. Where tables share a key the earlier
+    // table's value is kept, so a single longest_match gives the same result as
+    // probing the tables in order and keeping the first of the longest matches.
+    pub(crate) fn merged(tries: &[&Trie]) -> Self {
+        let mut table = HashMap::new();
+        for trie in tries {
+            for (key, value) in trie.entries() {
+                table.entry(key).or_insert_with(|| value.to_string());
+            }
+        }
+        let max_length = tries.iter().map(|trie| trie.max_length).max().unwrap_or(0);
+        Trie::from_dictionary(&(table, max_length))
+    }
+
+    // Every key with its value
+    pub(crate) fn entries(&self) -> Vec<(String, &str)> {
+        let bytes = self.as_bytes();
+        let first_child_at = self.node_count;
+        let values_at = 2 * self.node_count + 1;
+        // Breadth-first order puts every parent before its children
+        let mut keys = vec![String::new(); self.node_count];
+        let mut entries = Vec::with_capacity(self.value_count);
+        for node in 0..self.node_count {
+            let children =
+                word(bytes, first_child_at + node)..word(bytes, first_child_at + node + 1);
+            for child in children {
+                let mut key = keys[node].clone();
+                key.extend(char::from_u32(word(bytes, child as usize)));
+                keys[child as usize] = key;
+            }
+            let value = word(bytes, values_at + node);
+            if node > 0 && value != 0 {
+                entries.push((
+                    std::mem::take(&mut keys[node]),
+                    self.value(bytes, value as usize - 1),
+                ));
+            }
+        }
+        entries
+    }
+
+    // View a serialized trie inside shared storage, validating it so lookups can never
+    // read out of bounds or slice the value pool off a char boundary
+    pub(crate) fn from_storage(
+        storage: Arc<Storage>,
+        start: usize,
+        len: usize,
+        node_count: usize,
+        value_count: usize,
+        max_length: usize,
+    ) -> io::Result<Self> {
+        let invalid = |msg: &str| io::Error::new(io::ErrorKind::InvalidData, msg.to_string());
+        let bytes = storage
+            .as_slice()
+            .get(start..start.saturating_add(len))
+            .ok_or_else(|| invalid("trie section out of range"))?;
+        let words = node_count
+            .checked_mul(3)
+            .and_then(|n| n.checked_add(value_count + 2))
+            .ok_or_else(|| invalid("trie header overflow"))?;
+        if node_count == 0 || words.saturating_mul(4) > bytes.len() {
+            return Err(invalid("trie section truncated"));
+        }
+        let pool = std::str::from_utf8(&bytes[4 * words..])
+            .map_err(|_| invalid("trie value pool is not UTF-8"))?;
+        let first_child_at = node_count;
+        let values_at = 2 * node_count + 1;
+        let offsets_at = values_at + node_count;
+        for node in 0..=node_count {
+            let child = word(bytes, first_child_at + node) as usize;
+            if child > node_count
+                || (node > 0 && child < word(bytes, first_child_at + node - 1) as usize)
+            {
+                return Err(invalid("trie child ranges are not ordered"));
+            }
+        }
+        // The root can not be a child, and every edge is labelled with a codepoint
+        if word(bytes, first_child_at) == 0 && word(bytes, first_child_at + 1) > 0 {
+            return Err(invalid("trie root is its own child"));
+        }
+        if (1..node_count).any(|node| char::from_u32(word(bytes, node)).is_none()) {
+            return Err(invalid("trie label is not a codepoint"));
+        }
+        for node in 0..node_count {
+            if word(bytes, values_at + node) as usize > value_count {
+                return Err(invalid("trie value index out of range"));
+            }
+        }
+        let mut previous = 0;
+        for index in 0..=value_count {
+            let offset = word(bytes, offsets_at + index) as usize;
+            if offset < previous || offset > pool.len() || !pool.is_char_boundary(offset) {
+                return Err(invalid("trie value offsets are invalid"));
+            }
+            previous = offset;
+        }
+
+        Ok(Trie {
+            storage,
+            start,
+            len,
+            node_count,
+            value_count,
+            max_length,
+            starters: OnceLock::new(),
+            multi_char_key_chars: OnceLock::new(),
+            remapped_chars: OnceLock::new(),
+            root_index: OnceLock::new(),
+        })
+    }
+
+    // Serialized form, as laid out above
+    pub(crate) fn as_bytes(&self) -> &[u8] {
+        &self.storage.as_slice()[self.start..self.start + self.len]
+    }
+
+    pub(crate) fn node_count(&self) -> usize {
+        self.node_count
+    }
+
+    pub(crate) fn value_count(&self) -> usize {
+        self.value_count
+    }
+
+    // Maximum key length in chars, as recorded by the source dictionary
+    pub fn max_length(&self) -> usize {
+        self.max_length
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.value_count == 0
+    }
+
+    // Whether some key starts with `ch`; when none does, longest_match cannot match
+    #[inline]
+    pub(crate) fn may_start(&self, ch: char) -> bool {
+        self.starters().contains(ch)
+    }
+
+    pub(crate) fn starts_with_ascii_alnum(&self) -> bool {
+        self.starters().contains_ascii_alnum()
+    }
+
+    // Whether `ch` occurs in some key longer than one char
+    pub(crate) fn in_multi_char_key(&self, ch: char) -> bool {
+        self.multi_char_key_chars
+            .get_or_init(|| {
+                let bytes = self.as_bytes();
+                let first_child_at = self.node_count;
+                let depth_one_end = word(bytes, first_child_at + 1) as usize;
+                // Depth-one nodes count only when a longer key continues from them
+                CharSet::new((1..self.node_count).filter_map(|node| {
+                    let has_children =
+                        word(bytes, first_child_at + node) < word(bytes, first_child_at + node + 1);
+                    if node >= depth_one_end || has_children {
+                        char::from_u32(word(bytes, node))
+                    } else {
+                        None
+                    }
+                }))
+            })
+            .contains(ch)
+    }
+
+    // Whether `ch` is a key by itself and maps to a different value
+    pub(crate) fn remaps(&self, ch: char) -> bool {
+        self.remapped_chars
+            .get_or_init(|| {
+                let bytes = self.as_bytes();
+                let first_child_at = self.node_count;
+                let values_at = 2 * self.node_count + 1;
+                let children = word(bytes, first_child_at)..word(bytes, first_child_at + 1);
+                CharSet::new(children.filter_map(|child| {
+                    let key = char::from_u32(word(bytes, child as usize))?;
+                    let value = word(bytes, values_at + child as usize);
+                    let mut buffer = [0; 4];
+                    (value != 0
+                        && self.value(bytes, value as usize - 1) != key.encode_utf8(&mut buffer))
+                    .then_some(key)
+                }))
+            })
+            .contains(ch)
+    }
+
+    fn root_index(&self) -> &RootIndex {
+        self.root_index.get_or_init(|| {
+            let bytes = self.as_bytes();
+            let first_child_at = self.node_count;
+            let children = word(bytes, first_child_at)..word(bytes, first_child_at + 1);
+            RootIndex::new(children.map(|child| (word(bytes, child as usize), child)))
+        })
+    }
+
+    fn starters(&self) -> &CharSet {
+        self.starters.get_or_init(|| {
+            let bytes = self.as_bytes();
+            let first_child_at = self.node_count;
+            let children = word(bytes, first_child_at)..word(bytes, first_child_at + 1);
+            CharSet::new(children.filter_map(|child| char::from_u32(word(bytes, child as usize))))
+        })
+    }
+
+    // Longest key that prefixes `text`, at most `max_chars` chars long.
+    // Returns the matched length in bytes and the mapped value.
+    pub fn longest_match(&self, text: &str, max_chars: usize) -> Option<(usize, &str)> {
+        let bytes = self.as_bytes();
+        let values_at = 2 * self.node_count + 1;
+        let mut node = 0;
+        let mut best = None;
+        for (count, (offset, ch)) in text.char_indices().enumerate() {
+            if count == max_chars {
+                break;
+            }
+            let child = if count == 0 {
+                self.root_index().get(ch)
+            } else {
+                self.child(bytes, node, ch as u32)
+            };
+            node = match child {
+                Some(child) => child,
+                None => break,
+            };
+            let value = word(bytes, values_at + node);
+            if value != 0 {
+                best = Some((offset + ch.len_utf8(), value as usize - 1));
+            }
+        }
+        best.map(|(length, value)| (length, self.value(bytes, value)))
+    }
+
+    fn child(&self, bytes: &[u8], node: usize, label: u32) -> Option<usize> {
+        let first_child_at = self.node_count;
+        let mut low = word(bytes, first_child_at + node) as usize;
+        let mut high = word(bytes, first_child_at + node + 1) as usize;
+        while low < high {
+            let mid = (low + high) / 2;
+            let mid_label = word(bytes, mid);
+            if mid_label == label {
+                return Some(mid);
+            } else if mid_label < label {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        None
+    }
+
+    fn value<'t>(&self, bytes: &'t [u8], index: usize) -> &'t str {
+        let offsets_at = 3 * self.node_count + 1;
+        let pool_at = 4 * (offsets_at + self.value_count + 1);
+        let start = pool_at + word(bytes, offsets_at + index) as usize;
+        let end = pool_at + word(bytes, offsets_at + index + 1) as usize;
+        // SAFETY: the pool is valid UTF-8 and every value offset lies on a char boundary,
+        // either by construction or as checked in from_storage
+        unsafe { std::str::from_utf8_unchecked(&bytes[start..end]) }
+    }
+}
+
+// Read the little-endian u32 at word index `index`
+#[inline]
+fn word(bytes: &[u8], index: usize) -> u32 {
+    let at = 4 * index;
+    u32::from_le_bytes([bytes[at], bytes[at + 1], bytes[at + 2], bytes[at + 3]])
+}
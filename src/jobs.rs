@@ -0,0 +1,127 @@
+use std::sync::atomic::{AtomicU8, AtomicUsize, Ordering};
+use std::sync::Arc;
+
+// Background jobs a handle accepts before OpenCC::spawn refuses more
+pub const DEFAULT_MAX_PENDING_JOBS: usize = 1024;
+
+// Where a job queued by OpenCC::spawn stands
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum JobState {
+    Queued,
+    Running,
+    // The job returned (or panicked)
+    Done,
+    Cancelled,
+}
+
+const QUEUED: u8 = 0;
+const RUNNING: u8 = 1;
+const DONE: u8 = 2;
+const CANCELLED: u8 = 3;
+
+// Background jobs of one handle. A job holds a slot from the time it is queued until
+// it finishes or is cancelled, and no more than `limit` slots are handed out.
+pub(crate) struct JobQueue {
+    pending: Arc<AtomicUsize>,
+    limit: AtomicUsize,
+}
+
+// Handle on one queued job, to follow or cancel it
+pub struct JobHandle {
+    job: Arc<JobShared>,
+}
+
+struct JobShared {
+    state: AtomicU8,
+    pending: Arc<AtomicUsize>,
+}
+
+impl JobQueue {
+    pub(crate) fn new() -> Self {
+        JobQueue {
+            pending: Arc::new(AtomicUsize::new(0)),
+            limit: AtomicUsize::new(DEFAULT_MAX_PENDING_JOBS),
+        }
+    }
+
+    pub(crate) fn pending(&self) -> usize {
+        self.pending.load(Ordering::Acquire)
+    }
+
+    pub(crate) fn limit(&self) -> usize {
+        self.limit.load(Ordering::Relaxed)
+    }
+
+    pub(crate) fn set_limit(&self, limit: usize) {
+        self.limit.store(limit, Ordering::Relaxed);
+    }
+
+    // Take a slot for `job` and wrap it for the pool; None while every slot is taken.
+    // The wrapper passes true to a job that was cancelled before it started.
+    pub(crate) fn prepare(
+        &self,
+        job: impl FnOnce(bool) + Send + 'static,
+    ) -> Option<(JobHandle, impl FnOnce() + Send + 'static)> {
+        let limit = self.limit();
+        self.pending
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |pending| {
+                (pending < limit).then_some(pending + 1)
+            })
+            .ok()?;
+        let shared = Arc::new(JobShared {
+            state: AtomicU8::new(QUEUED),
+            pending: Arc::clone(&self.pending),
+        });
+        let handle = JobHandle {
+            job: Arc::clone(&shared),
+        };
+        let run = move || {
+            let started =
+                shared
+                    .state
+                    .compare_exchange(QUEUED, RUNNING, Ordering::AcqRel, Ordering::Acquire);
+            if started.is_err() {
+                // The slot was given back by cancel
+                job(true);
+                return;
+            }
+            // Gives the slot back even if the job panics
+            let _finish = Finish(&shared);
+            job(false);
+        };
+        Some((handle, run))
+    }
+}
+
+struct Finish<'a>(&'a JobShared);
+
+impl Drop for Finish<'_> {
+    fn drop(&mut self) {
+        self.0.state.store(DONE, Ordering::Release);
+        self.0.pending.fetch_sub(1, Ordering::Release);
+    }
+}
+
+impl JobHandle {
+    pub fn state(&self) -> JobState {
+        match self.job.state.load(Ordering::Acquire) {
+            QUEUED => JobState::Queued,
+            RUNNING => JobState::Running,
+            DONE => JobState::Done,
+            _ => JobState::Cancelled,
+        }
+    }
+
+    // Cancel the job if it has not started, giving its slot back at once; the job
+    // still runs later, told that it was cancelled. Returns false once it has started.
+    pub fn cancel(&self) -> bool {
+        let cancelled =
+            self.job
+                .state
+                .compare_exchange(QUEUED, CANCELLED, Ordering::AcqRel, Ordering::Acquire);
+        if cancelled.is_ok() {
+            self.job.pending.fetch_sub(1, Ordering::Release);
+        }
+        cancelled.is_ok()
+    }
+}
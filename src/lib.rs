@@ -1,517 +1,1485 @@
 use lazy_static::lazy_static;
-use std::collections::{HashMap, HashSet};
+use std::borrow::Cow;
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::error::Error;
 use std::iter::Iterator;
-use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, OnceLock};
+use std::{fs, io};
 
 use rayon::prelude::*;
-use regex::Regex;
 
-use crate::dictionary_lib::DictionaryMaxlength;
+use crate::cache::{CacheKey, ConversionCache, Lookup};
+use crate::dictionary_lib::{DictId, DictionaryMaxlength, Trie};
+use crate::jobs::JobQueue;
+use crate::overlay::{OverlayStore, Overlays};
+use crate::scan::CharSet;
+use crate::spans::SpanRecorder;
+use crate::stats::{CallCounts, MatchCounts, MatchObserver, Stats};
+mod cache;
 pub mod dictionary_lib;
-// Define a global mutable variable to store the error message
-static LAST_ERROR: Mutex<Option<String>> = Mutex::new(None);
+mod jobs;
+mod overlay;
+mod scan;
+mod spans;
+mod stats;
+mod stream;
+pub use cache::{CacheStats, DEFAULT_CACHE_MAX_INPUT_BYTES};
+pub use jobs::{JobHandle, JobState, DEFAULT_MAX_PENDING_JOBS};
+pub use spans::Span;
+pub use stats::{ConfigStats, ConversionStats, RoundStats, MATCH_LENGTH_BUCKETS, MAX_ROUNDS};
+pub use stream::ConversionStream;
+thread_local! {
+    // Last error message of the calling thread
+    static LAST_ERROR: RefCell<Option<String>> = RefCell::new(None);
+}
 const DELIMITERS: &'static str = "\t\n\r (){}[]<>\"'\\/|-,.?!*:;@#$%^&_+=　，。、；：？！…“”‘’『』「」﹁﹂—－（）《》〈〉～．／＼︒︑︔︓︿﹀︹︺︙︐［﹇］﹈︕︖︰︳︴︽︾︵︶｛︷｝︸﹃﹄【︻】︼";
+// Bitmap form of DELIMITERS, shared by all handles
+static DELIMITER_SET: OnceLock<CharSet> = OnceLock::new();
+// Process-wide immutable dictionary behind OpenCC::new_shared()
+static SHARED_DICTIONARY: OnceLock<Arc<DictionaryMaxlength>> = OnceLock::new();
 lazy_static! {
-    static ref STRIP_REGEX: Regex = Regex::new(r"[!-/:-@\[-`{-~\t\n\v\f\r 0-9A-Za-z_]").unwrap();
+    // Simplified-to-Traditional and Traditional-to-Simplified quote tables
+    static ref PUNCTUATION_TABLES: [PunctuationTable; 2] = [
+        PunctuationTable::new(PUNCTUATION_PAIRS.iter().copied()),
+        PunctuationTable::new(PUNCTUATION_PAIRS.iter().map(|&(s, t)| (t, s))),
+    ];
+}
+thread_local! {
+    // Ping-pong buffers for multi-round chunk conversion, reused by every call on a thread
+    static ROUND_BUFFERS: RefCell<(String, String)> = RefCell::new((String::new(), String::new()));
+}
+// Quote marks converted with punctuation enabled, as (Simplified, Traditional)
+const PUNCTUATION_PAIRS: [(char, char); 4] = [('“', '「'), ('”', '」'), ('‘', '『'), ('’', '』')];
+// Bytes of non-ASCII text zho_check looks at
+const ZHO_CHECK_BYTES: usize = 200;
+// Round buffers larger than this are shrunk back after use
+const ROUND_BUFFER_LIMIT: usize = 64 * 1024;
+// Target size of the pieces a parallel conversion is split into
+const WORK_UNIT_BYTES: usize = 32 * 1024;
+// Inputs shorter than this are converted serially under the default policy
+pub const DEFAULT_PARALLEL_THRESHOLD: usize = 32 * 1024;
+
+// When conversions use rayon. Splitting and dispatching costs more than it saves on
+// short inputs, so the default only goes parallel from DEFAULT_PARALLEL_THRESHOLD bytes.
+#[derive(Clone)]
+pub enum ParallelPolicy {
+    Serial,
+    Parallel,
+    // Parallel for inputs of at least this many bytes
+    Threshold(usize),
+    // Parallel from `threshold` bytes, on a caller-provided pool instead of the global one
+    Pool {
+        pool: Arc<rayon::ThreadPool>,
+        threshold: usize,
+    },
 }
+
+impl ParallelPolicy {
+    // Parallel from `threshold` bytes on a dedicated pool of at most `max_threads` threads
+    pub fn with_max_threads(
+        max_threads: usize,
+        threshold: usize,
+    ) -> Result<Self, rayon::ThreadPoolBuildError> {
+        let pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(max_threads)
+            .build()?;
+        Ok(ParallelPolicy::Pool {
+            pool: Arc::new(pool),
+            threshold,
+        })
+    }
+
+    fn is_parallel_for(&self, len: usize) -> bool {
+        match self {
+            ParallelPolicy::Serial => false,
+            ParallelPolicy::Parallel => true,
+            ParallelPolicy::Threshold(threshold) => len >= *threshold,
+            ParallelPolicy::Pool { threshold, .. } => len >= *threshold,
+        }
+    }
+
+    // Run parallel work on the policy's pool, if it has one
+    fn install<R: Send>(&self, op: impl FnOnce() -> R + Send) -> R {
+        match self {
+            ParallelPolicy::Pool { pool, .. } => pool.install(op),
+            _ => op(),
+        }
+    }
+
+    // Queue a background job on the policy's pool, or on the global one
+    fn spawn(&self, job: impl FnOnce() + Send + 'static) {
+        match self {
+            ParallelPolicy::Pool { pool, .. } => pool.spawn(job),
+            _ => rayon::spawn(job),
+        }
+    }
+}
+
+impl Default for ParallelPolicy {
+    fn default() -> Self {
+        ParallelPolicy::Threshold(DEFAULT_PARALLEL_THRESHOLD)
+    }
+}
+
+// A handle's parallel policy, held in one atomic word (mode in the low bits, threshold
+// above them) so it can be changed through a shared reference while other threads
+// convert, and a reader never mixes two policies; the lock is only taken for pools
+struct ParallelSettings {
+    policy: AtomicU64,
+    pool: Mutex<Option<Arc<rayon::ThreadPool>>>,
+}
+
+const MODE_SERIAL: u8 = 0;
+const MODE_PARALLEL: u8 = 1;
+const MODE_THRESHOLD: u8 = 2;
+const MODE_POOL: u8 = 3;
+const MODE_BITS: u32 = 2;
+
+impl ParallelSettings {
+    fn new(policy: ParallelPolicy) -> Self {
+        let settings = ParallelSettings {
+            policy: AtomicU64::new(MODE_SERIAL as u64),
+            pool: Mutex::new(None),
+        };
+        settings.store(policy);
+        settings
+    }
+
+    fn mode(&self) -> u8 {
+        Self::mode_of(self.policy.load(Ordering::Acquire))
+    }
+
+    fn mode_of(policy: u64) -> u8 {
+        (policy & ((1 << MODE_BITS) - 1)) as u8
+    }
+
+    fn load(&self) -> ParallelPolicy {
+        let policy = self.policy.load(Ordering::Acquire);
+        let threshold = usize::try_from(policy >> MODE_BITS).unwrap_or(usize::MAX);
+        match Self::mode_of(policy) {
+            MODE_SERIAL => ParallelPolicy::Serial,
+            MODE_PARALLEL => ParallelPolicy::Parallel,
+            MODE_POOL => match self.pool.lock().unwrap().as_ref() {
+                Some(pool) => ParallelPolicy::Pool {
+                    pool: Arc::clone(pool),
+                    threshold,
+                },
+                None => ParallelPolicy::Threshold(threshold),
+            },
+            _ => ParallelPolicy::Threshold(threshold),
+        }
+    }
+
+    fn store(&self, policy: ParallelPolicy) {
+        let (mode, threshold) = match policy {
+            ParallelPolicy::Serial => (MODE_SERIAL, 0),
+            ParallelPolicy::Parallel => (MODE_PARALLEL, 0),
+            ParallelPolicy::Threshold(threshold) => (MODE_THRESHOLD, threshold),
+            ParallelPolicy::Pool { pool, threshold } => {
+                *self.pool.lock().unwrap() = Some(pool);
+                (MODE_POOL, threshold)
+            }
+        };
+        // Thresholds beyond what the word holds mean the same as the largest it does
+        let threshold = (threshold as u64).min(u64::MAX >> MODE_BITS);
+        self.policy
+            .store(threshold << MODE_BITS | mode as u64, Ordering::Release);
+    }
+}
+
+// Progress of zho_check over a text that may arrive in pieces: counts of Traditional
+// and Simplified-only chars in the scanned prefix, and whether the scan reached the
+// prefix limit, after which more text cannot change the verdict
+#[derive(Clone, Copy, Default)]
+pub(crate) struct ScriptScan {
+    traditional: usize,
+    simplified_only: usize,
+    scanned: usize,
+    pub(crate) settled: bool,
+}
+
+impl ScriptScan {
+    // zho_check code and confidence for the text scanned so far
+    pub(crate) fn verdict(&self) -> (i32, f64) {
+        let specific = (self.traditional + self.simplified_only) as f64;
+        if self.traditional > 0 {
+            (1, self.traditional as f64 / specific)
+        } else if self.simplified_only > 0 {
+            (2, 1.0)
+        } else {
+            (0, 0.0)
+        }
+    }
+}
+
+// A lightweight handle: the dictionary is immutable and may be shared between handles,
+// while settings such as the parallel policy belong to each handle. Every method takes
+// &self, and a handle may be used from many threads at once.
 pub struct OpenCC {
-    dictionary: DictionaryMaxlength,
-    delimiters: HashSet<char>,
-    is_parallel: bool,
+    dictionary: Arc<DictionaryMaxlength>,
+    delimiters: &'static CharSet,
+    parallel: ParallelSettings,
+    stats: Stats,
+    cache: ConversionCache,
+    overlays: OverlayStore,
+    // Jobs queued by spawn and not finished yet
+    jobs: JobQueue,
 }
 
 impl OpenCC {
     pub fn new() -> Self {
-        let dictionary = DictionaryMaxlength::new().unwrap_or_else(|err| {
+        let dictionary = DictionaryMaxlength::from_embedded_binary().unwrap_or_else(|err| {
             Self::set_last_error(&format!("Failed to create dictionary: {}", err));
             // Since DictionaryMaxlength::new() returns a DictionaryMaxlength
             // instance on success, we create a default instance here to
             // maintain the structure of OpenCC.
             DictionaryMaxlength::default()
         });
-        let delimiters = DELIMITERS.chars().collect();
-        let is_parallel = true;
+
+        Self::with_dictionary(Arc::new(dictionary))
+    }
+
+    // Dictionary tables are only read when a config first needs them; this also makes
+    // the tables of `configs` (names such as "s2twp") ready up front. Unknown names and
+    // tables that fail to load set the last error.
+    pub fn with_configs(configs: &[&str]) -> Self {
+        let opencc = Self::new();
+        for name in configs {
+            let loaded = match OpenccConfig::from_name(name) {
+                Some(config) => opencc.preload(config),
+                None => Err(format!("Invalid config: {}", name).into()),
+            };
+            if let Err(err) = loaded {
+                Self::set_last_error(&err.to_string());
+            }
+        }
+        opencc
+    }
+
+    // Handle on the process-wide default dictionary, loaded once and shared by every
+    // handle created this way
+    pub fn new_shared() -> Self {
+        let dictionary = SHARED_DICTIONARY.get_or_init(|| {
+            Arc::new(
+                DictionaryMaxlength::from_embedded_binary().unwrap_or_else(|err| {
+                    Self::set_last_error(&format!("Failed to create dictionary: {}", err));
+                    DictionaryMaxlength::default()
+                }),
+            )
+        });
+
+        Self::with_dictionary(Arc::clone(dictionary))
+    }
+
+    // Handle on an existing shared dictionary, with default per-handle settings
+    pub fn with_dictionary(dictionary: Arc<DictionaryMaxlength>) -> Self {
+        let delimiters = DELIMITER_SET.get_or_init(|| CharSet::new(DELIMITERS.chars()));
+        let parallel = ParallelSettings::new(ParallelPolicy::default());
 
         OpenCC {
             dictionary,
             delimiters,
-            is_parallel,
+            parallel,
+            stats: Stats::new(),
+            cache: ConversionCache::new(),
+            overlays: OverlayStore::new(),
+            jobs: JobQueue::new(),
         }
     }
 
+    // New handle sharing this handle's dictionary; settings are copied, not shared
+    pub fn clone_handle(&self) -> Self {
+        let handle = Self::with_dictionary(Arc::clone(&self.dictionary));
+        handle.set_parallel_policy(self.parallel_policy());
+        let (capacity, max_input_bytes) = self.cache.limits();
+        handle.set_cache(capacity, max_input_bytes);
+        handle.overlays.copy_from(&self.overlays);
+        handle.set_max_pending_jobs(self.jobs.limit());
+
+        handle
+    }
+
+    pub fn dictionary(&self) -> &Arc<DictionaryMaxlength> {
+        &self.dictionary
+    }
+
     pub fn from_dicts() -> Self {
         let dictionary = DictionaryMaxlength::from_dicts();
-        let delimiters = DELIMITERS.chars().collect();
-        let is_parallel = true;
 
-        OpenCC {
-            dictionary,
-            delimiters,
-            is_parallel,
-        }
+        Self::with_dictionary(Arc::new(dictionary))
     }
     pub fn from_json(filename: &str) -> Self {
         let dictionary = DictionaryMaxlength::from_json(filename).unwrap_or_else(|err| {
             Self::set_last_error(&format!("Failed to create dictionary: {}", err));
             DictionaryMaxlength::default()
         });
-        let delimiters = DELIMITERS.chars().collect();
-        let is_parallel = true;
 
-        OpenCC {
-            dictionary,
-            delimiters,
-            is_parallel,
-        }
+        Self::with_dictionary(Arc::new(dictionary))
+    }
+    pub fn from_binary(filename: &str) -> Self {
+        let dictionary = DictionaryMaxlength::from_binary(filename).unwrap_or_else(|err| {
+            Self::set_last_error(&format!("Failed to create dictionary: {}", err));
+            DictionaryMaxlength::default()
+        });
+
+        Self::with_dictionary(Arc::new(dictionary))
     }
+
     fn segment_replace(
         &self,
         text: &str,
-        dictionaries: &[&(HashMap<String, String>, usize)],
-    ) -> String {
-        let mut max_word_length: usize = 1;
-        for i in 0..dictionaries.len() {
-            if max_word_length < dictionaries[i].1 {
-                max_word_length = dictionaries[i].1;
-            }
-        }
-
-        if self.is_parallel {
-            let split_string_list = self.split_string_inclusive_parallel(text);
-            self.get_translated_string_parallel(split_string_list, dictionaries, max_word_length)
+        dictionaries: &[&Trie],
+        max_word_length: usize,
+        output: &mut String,
+    ) {
+        let policy = self.parallel_policy();
+        if policy.is_parallel_for(text.len()) {
+            let result = policy.install(|| {
+                self.work_units(text, &[dictionaries])
+                    .par_iter()
+                    .map(|unit| self.get_translated_string(unit, dictionaries, max_word_length))
+                    .collect::<String>()
+            });
+            Self::append(output, result);
         } else {
-            let split_string_list = self.split_string_inclusive(text);
-            self.get_translated_string(split_string_list, dictionaries, max_word_length)
+            output.reserve(text.len());
+            for chunk in self.delimiters.split_inclusive(text) {
+                self.convert_by_into(chunk, dictionaries, max_word_length, output);
+            }
         }
     }
 
     fn get_translated_string(
         &self,
-        split_string_list: Vec<String>,
-        dictionaries: &[&(HashMap<String, String>, usize)],
+        text: &str,
+        dictionaries: &[&Trie],
         max_word_length: usize,
     ) -> String {
-        split_string_list
-            .iter()
-            .map(|chunk| self.convert_by(chunk, dictionaries, max_word_length))
-            .collect::<String>()
+        let mut result = String::with_capacity(text.len());
+        for chunk in self.delimiters.split_inclusive(text) {
+            self.convert_by_into(chunk, dictionaries, max_word_length, &mut result);
+        }
+        result
     }
 
-    fn get_translated_string_parallel(
-        &self,
-        split_string_list: Vec<String>,
-        dictionaries: &[&(HashMap<String, String>, usize)],
-        max_word_length: usize,
-    ) -> String {
-        split_string_list
-            .par_iter()
-            .map(|chunk| self.convert_by(chunk, dictionaries, max_word_length))
-            .collect::<String>()
+    // Cut `text` into pieces of about WORK_UNIT_BYTES that convert independently, for
+    // parallel conversion. A piece ends right after a delimiter or, inside a long run
+    // without delimiters, after a char that no match in any round can cross.
+    fn work_units<'t>(&self, text: &'t str, rounds: &[&[&Trie]]) -> Vec<&'t str> {
+        let mut units = Vec::with_capacity(text.len() / WORK_UNIT_BYTES + 1);
+        let mut start = 0;
+        while text.len() - start > WORK_UNIT_BYTES {
+            let mut target = start + WORK_UNIT_BYTES;
+            while !text.is_char_boundary(target) {
+                target += 1;
+            }
+            let end = self
+                .safe_cut(&text[target..], rounds)
+                .map_or(text.len(), |cut| target + cut);
+            units.push(&text[start..end]);
+            start = end;
+        }
+        if start < text.len() {
+            units.push(&text[start..]);
+        }
+        units
     }
 
-    #[allow(dead_code)]
-    fn get_translated_string_parallel_arc(
-        &self,
-        split_string_list: Vec<String>,
-        dictionaries: &[&(HashMap<String, String>, usize)],
-        max_word_length: usize,
-    ) -> String {
-        let result = Arc::new(Mutex::new(Vec::<(usize, String)>::new()));
-        split_string_list
-            .par_iter()
-            .enumerate()
-            .for_each(|(index, chunk)| {
-                let converted = self.convert_by(chunk, dictionaries, max_word_length);
-                let mut result_lock = result.lock().unwrap();
-                result_lock.push((index, converted));
-            });
-        let mut result_lock = result.lock().unwrap();
-        result_lock.par_sort_by_key(|(index, _)| *index);
-
-        let concatenated_result: String = result_lock
-            .par_iter()
-            .map(|(_, chunk)| chunk.as_str())
-            .collect();
+    // Offset of the first point in `text` where conversion restarts cleanly. Looks one
+    // unit ahead for a delimiter or safe char, then settles for the next delimiter.
+    fn safe_cut(&self, text: &str, rounds: &[&[&Trie]]) -> Option<usize> {
+        let mut chars = text.char_indices().peekable();
+        let mut scanned = text.len();
+        while let Some((at, ch)) = chars.next() {
+            if at > WORK_UNIT_BYTES {
+                scanned = at;
+                break;
+            }
+            let end = at + ch.len_utf8();
+            if self.delimiters.contains(ch) {
+                return Some(end);
+            }
+            // The next piece must not start with a lone delimiter, which is never matched
+            let next_is_delimiter = chars
+                .peek()
+                .map_or(true, |&(_, next)| self.delimiters.contains(next));
+            if !next_is_delimiter && Self::is_cut_char(ch, rounds) {
+                return Some(end);
+            }
+        }
+        // Nothing before `scanned` is a delimiter
+        self.delimiters
+            .chunk_end(&text[scanned..])
+            .map(|end| scanned + end)
+    }
 
-        concatenated_result
+    // No key longer than one char contains `ch`, so no match spans a cut after it, and
+    // every round but the last leaves it unchanged for the next round to see
+    fn is_cut_char(ch: char, rounds: &[&[&Trie]]) -> bool {
+        rounds.iter().enumerate().all(|(index, dictionaries)| {
+            dictionaries.iter().all(|dictionary| {
+                !dictionary.in_multi_char_key(ch)
+                    && (index + 1 == rounds.len() || !dictionary.may_start(ch))
+            })
+        })
     }
 
-    fn convert_by(
+    // Append the conversion of one delimiter-bounded chunk to `result`
+    fn convert_by_into(
         &self,
         text: &str,
-        dictionaries: &[&(HashMap<String, String>, usize)],
+        dictionaries: &[&Trie],
         max_word_length: usize,
-    ) -> String {
-        if text.is_empty() {
-            return String::new();
-        }
-
-        let text_chars: Vec<_> = text.par_chars().collect();
-        let text_length = text_chars.len();
-        if text_length == 1 {
-            if self.delimiters.contains(&text_chars[0]) {
-                return text_chars[0].to_string();
+        result: &mut String,
+    ) {
+        let mut chars = text.chars();
+        if let (Some(ch), None) = (chars.next(), chars.next()) {
+            if self.delimiters.contains(ch) {
+                result.push(ch);
+                return;
             }
         }
 
-        let mut result = String::new();
-        result.reserve(text.len());
+        self.convert_prefix_into(text, dictionaries, max_word_length, result, false);
+    }
 
+    // Forward maximum matching over `text`, appending to `result`. With `partial` set,
+    // `text` may continue past its end, so matching stops at the first position with
+    // fewer than `max_word_length` chars left, whose match is not final yet.
+    // Returns the number of bytes consumed.
+    fn convert_prefix_into(
+        &self,
+        text: &str,
+        dictionaries: &[&Trie],
+        max_word_length: usize,
+        result: &mut String,
+        partial: bool,
+    ) -> usize {
+        self.convert_prefix_observed(
+            text,
+            dictionaries,
+            max_word_length,
+            result,
+            partial,
+            &mut (),
+        )
+    }
+
+    fn convert_prefix_observed<O: MatchObserver>(
+        &self,
+        text: &str,
+        dictionaries: &[&Trie],
+        max_word_length: usize,
+        result: &mut String,
+        partial: bool,
+        observer: &mut O,
+    ) -> usize {
+        // ASCII letters and digits can be copied in bulk unless some key starts with one
+        let skip_ascii_alnum = !dictionaries
+            .iter()
+            .any(|dictionary| dictionary.starts_with_ascii_alnum());
         let mut start_pos = 0;
-        while start_pos < text_length {
-            let max_length = std::cmp::min(max_word_length, text_length - start_pos);
-            let mut best_match_length = 0;
-            let mut best_match = String::new();
-
-            for length in 1..=max_length {
-                let candidate: String =
-                    text_chars[start_pos..(start_pos + length)].iter().collect();
-                for dictionary in dictionaries {
-                    if let Some(value) = dictionary.0.get(&candidate) {
-                        best_match_length = length;
-                        best_match = value.to_owned();
-                        break; // Push the corresponding value to the results
+        while start_pos < text.len() {
+            let rest = &text[start_pos..];
+            if skip_ascii_alnum && rest.as_bytes()[0].is_ascii_alphanumeric() {
+                let length = scan::ascii_alnum_run(rest.as_bytes());
+                result.push_str(&rest[..length]);
+                observer.miss(length);
+                start_pos += length;
+                continue;
+            }
+            // A char no key starts with is its own word, whatever follows it
+            let ch = rest.chars().next().unwrap();
+            if !dictionaries
+                .iter()
+                .any(|dictionary| dictionary.may_start(ch))
+            {
+                result.push(ch);
+                observer.miss(1);
+                start_pos += ch.len_utf8();
+                continue;
+            }
+            if partial && rest.chars().nth(max_word_length.max(1) - 1).is_none() {
+                break;
+            }
+            // Longest match across the round; on equal length the earlier dictionary wins
+            let mut best_match: Option<(usize, &str)> = None;
+            for dictionary in dictionaries {
+                if let Some((length, value)) = dictionary.longest_match(rest, max_word_length) {
+                    if best_match.map_or(true, |(best_length, _)| length > best_length) {
+                        best_match = Some((length, value));
                     }
                 }
             }
 
-            if best_match_length == 0 {
-                // If no match found, treat the character as a single word
-                best_match_length = 1;
-                best_match = text_chars[start_pos].to_string();
+            match best_match {
+                Some((length, value)) => {
+                    result.push_str(value);
+                    observer.hit(&rest[..length], value);
+                    start_pos += length;
+                }
+                None => {
+                    // If no match found, treat the character as a single word
+                    let length = rest.chars().next().map_or(1, char::len_utf8);
+                    result.push_str(&rest[..length]);
+                    observer.miss(1);
+                    start_pos += length;
+                }
             }
+        }
+        start_pos
+    }
 
-            result.push_str(&best_match);
-            start_pos += best_match_length;
+    // Fused multi-round conversion: every delimiter-bounded chunk goes through all rounds
+    // while it is still hot, and only the final outputs are stitched together. Dictionaries
+    // never map a delimiter to a non-delimiter, so chunk boundaries are the same in every
+    // round and the result matches running segment_replace once per round.
+    fn segment_replace_rounds(&self, text: &str, rounds: &[DictRound], output: &mut String) {
+        let policy = self.parallel_policy();
+        if policy.is_parallel_for(text.len()) {
+            let tries: Vec<&[&Trie]> = rounds
+                .iter()
+                .map(|round| round.dictionaries.as_slice())
+                .collect();
+            let result = policy.install(|| {
+                self.work_units(text, &tries)
+                    .par_iter()
+                    .map(|unit| self.segment_replace_rounds_serial(unit, rounds))
+                    .collect::<String>()
+            });
+            Self::append(output, result);
+        } else {
+            self.segment_replace_rounds_into(text, rounds, output);
         }
+    }
 
+    fn segment_replace_rounds_serial(&self, text: &str, rounds: &[DictRound]) -> String {
+        let mut result = String::with_capacity(text.len());
+        self.segment_replace_rounds_into(text, rounds, &mut result);
         result
     }
 
-    fn split_string_inclusive(&self, text: &str) -> Vec<String> {
-        let mut split_string_list = Vec::new();
-        let mut current_chunk = String::new();
-
-        for ch in text.chars() {
-            if self.delimiters.contains(&ch) {
-                split_string_list.push(current_chunk + &ch.to_string());
-                current_chunk = String::new();
-            } else {
-                current_chunk.push(ch);
+    // Uses this thread's round buffers, so converting into a reused `output` does not
+    // allocate once the buffers have grown to the chunk sizes seen
+    fn segment_replace_rounds_into(&self, text: &str, rounds: &[DictRound], output: &mut String) {
+        ROUND_BUFFERS.with(|buffers| match buffers.try_borrow_mut() {
+            Ok(mut buffers) => {
+                let (current, next) = &mut *buffers;
+                self.convert_chunks_rounds_into(text, rounds, output, current, next);
+                // Do not keep the memory of an unusually long chunk around
+                if current.capacity() > ROUND_BUFFER_LIMIT {
+                    current.shrink_to(ROUND_BUFFER_LIMIT);
+                    next.shrink_to(ROUND_BUFFER_LIMIT);
+                }
             }
+            Err(_) => self.convert_chunks_rounds_into(
+                text,
+                rounds,
+                output,
+                &mut String::new(),
+                &mut String::new(),
+            ),
+        })
+    }
+
+    fn convert_chunks_rounds_into(
+        &self,
+        text: &str,
+        rounds: &[DictRound],
+        output: &mut String,
+        current: &mut String,
+        next: &mut String,
+    ) {
+        output.reserve(text.len());
+        for chunk in self.delimiters.split_inclusive(text) {
+            self.convert_chunk_rounds_into(chunk, rounds, current, next);
+            output.push_str(current);
         }
-        // Current_chunk still have chars but current_delimiter is empty
-        if !current_chunk.is_empty() {
-            split_string_list.push(current_chunk);
+    }
+
+    // Move `result` into an empty `output` instead of copying it
+    fn append(output: &mut String, result: String) {
+        if output.is_empty() {
+            *output = result;
+        } else {
+            output.push_str(&result);
+        }
+    }
+
+    // Ping-pong between two scratch buffers; the converted chunk ends up in `current`
+    fn convert_chunk_rounds_into(
+        &self,
+        chunk: &str,
+        rounds: &[DictRound],
+        current: &mut String,
+        next: &mut String,
+    ) {
+        current.clear();
+        current.push_str(chunk);
+        for round in rounds {
+            next.clear();
+            // A round's output may itself contain delimiters, which the next round splits on
+            for piece in self.delimiters.split_inclusive(current) {
+                self.convert_by_into(piece, &round.dictionaries, round.max_word_length, next);
+            }
+            std::mem::swap(current, next);
         }
+    }
+
+    // Conversion never matches across a delimiter, so text may be cut right after one
+    // and the pieces converted independently
+    pub fn is_delimiter(&self, ch: char) -> bool {
+        self.delimiters.contains(ch)
+    }
+
+    // Whether the policy allows parallel conversion at all
+    pub fn get_parallel(&self) -> bool {
+        self.parallel.mode() != MODE_SERIAL
+    }
+
+    // true selects the default size-threshold policy, false always converts serially
+    pub fn set_parallel(&self, is_parallel: bool) -> () {
+        self.set_parallel_policy(if is_parallel {
+            ParallelPolicy::default()
+        } else {
+            ParallelPolicy::Serial
+        });
+    }
+
+    pub fn parallel_policy(&self) -> ParallelPolicy {
+        self.parallel.load()
+    }
+
+    // Takes effect for conversions started afterwards, including on other threads
+    pub fn set_parallel_policy(&self, policy: ParallelPolicy) {
+        self.parallel.store(policy);
+    }
+
+    // Collect conversion counters (see ConversionStats). While enabled, conversions
+    // run serially and round by round so each round can be timed; streams are not
+    // counted.
+    pub fn set_stats_enabled(&self, enabled: bool) {
+        self.stats.set_enabled(enabled);
+    }
+
+    pub fn stats_enabled(&self) -> bool {
+        self.stats.is_enabled()
+    }
+
+    pub fn stats(&self) -> ConversionStats {
+        self.stats.snapshot()
+    }
+
+    pub fn reset_stats(&self) {
+        self.stats.reset();
+    }
+
+    // Remember up to `capacity` conversions of inputs of at most `max_input_bytes`
+    // (e.g. DEFAULT_CACHE_MAX_INPUT_BYTES), for traffic that repeats the same short
+    // strings. Either limit being 0 turns the cache off. Reconfiguring empties it.
+    pub fn set_cache(&self, capacity: usize, max_input_bytes: usize) {
+        self.cache.configure(capacity, max_input_bytes);
+    }
+
+    pub fn cache_stats(&self) -> CacheStats {
+        self.cache.stats()
+    }
+
+    // Run `job` in the background on the handle's pool (the dedicated pool of a Pool
+    // policy, otherwise rayon's global pool), e.g. to keep a conversion off an event
+    // loop thread. `job` is passed true if it was cancelled (see JobHandle::cancel)
+    // before it started. Returns None, dropping the job, while `max_pending_jobs` jobs
+    // of this handle are already queued or running, so producers can back off.
+    pub fn spawn(&self, job: impl FnOnce(bool) + Send + 'static) -> Option<JobHandle> {
+        let (handle, run) = self.jobs.prepare(job)?;
+        self.parallel_policy().spawn(run);
+        Some(handle)
+    }
+
+    // Jobs queued by spawn that have not finished (or been cancelled) yet
+    pub fn pending_jobs(&self) -> usize {
+        self.jobs.pending()
+    }
 
-        split_string_list
+    // Bound on pending jobs, DEFAULT_MAX_PENDING_JOBS by default; 0 refuses every job
+    pub fn set_max_pending_jobs(&self, limit: usize) {
+        self.jobs.set_limit(limit);
     }
 
-    fn split_string_inclusive_parallel(&self, text: &str) -> Vec<String> {
-        let split_string_list: Vec<String> = text
-            .par_chars()
-            .collect::<Vec<char>>()
-            .par_split_inclusive_mut(|c| self.delimiters.contains(c))
-            .map(|slice| slice.iter().collect())
+    // Layer user entries over a built-in table: every round reading `table` consults
+    // them first, so they win over built-in words of the same length (a longer
+    // built-in match still wins, as forward maximum matching always does). Entries
+    // accumulate across calls, later ones replacing earlier keys. A call costs a
+    // rebuild of this table's entries added since its last merge; once those outgrow
+    // 4096 entries (or a quarter of the table) the whole table is rebuilt, so adding
+    // one large file beats many small calls. Conversions already running, and
+    // converters or streams created before the call, keep the entries they started with.
+    pub fn add_overlay(&self, table: DictId, entries: &[(&str, &str)]) -> io::Result<()> {
+        let entries = entries
+            .iter()
+            .map(|&(key, value)| (key.to_string(), value.to_string()))
             .collect();
+        self.add_overlay_entries(table, entries)
+    }
 
-        split_string_list
+    // Load a user dictionary in the format of the built-in dicts/*.txt files ("key
+    // value" per line) as an overlay. The file is named after the table it overlays,
+    // e.g. "STPhrases.txt" or "TWPhrases.txt" (see DictId::file_name).
+    pub fn load_user_dict(&self, path: &str) -> io::Result<()> {
+        let file_name = std::path::Path::new(path)
+            .file_name()
+            .and_then(|name| name.to_str())
+            .unwrap_or("");
+        let table = DictId::from_file_name(file_name).ok_or_else(|| {
+            io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!("User dictionary must be named after a table: {}", path),
+            )
+        })?;
+        let content = fs::read_to_string(path)?;
+        let (entries, _) = DictionaryMaxlength::load_dictionary_maxlength(&content)?;
+        self.add_overlay_entries(table, entries)
     }
 
-    pub fn get_parallel(&self) -> bool {
-        self.is_parallel
+    pub fn clear_overlays(&self) {
+        self.overlays.clear();
     }
 
-    pub fn set_parallel(&mut self, is_parallel: bool) -> () {
-        self.is_parallel = is_parallel;
+    fn add_overlay_entries(
+        &self,
+        table: DictId,
+        entries: HashMap<String, String>,
+    ) -> io::Result<()> {
+        // Chunking relies on dictionaries leaving delimiters alone
+        for (key, value) in &entries {
+            if key.is_empty()
+                || key
+                    .chars()
+                    .chain(value.chars())
+                    .any(|ch| self.is_delimiter(ch))
+            {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidInput,
+                    format!("Invalid overlay entry: {} {}", key, value),
+                ));
+            }
+        }
+        self.overlays.add(table, entries);
+        Ok(())
     }
 
     pub fn s2t(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [&self.dictionary.st_phrases, &self.dictionary.st_characters];
-        let output = self.segment_replace(input, &dict_refs);
-        if punctuation {
-            Self::convert_punctuation(&output, "s")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::S2t, punctuation)
+            .convert(input)
     }
 
     pub fn t2s(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [&self.dictionary.ts_phrases, &self.dictionary.ts_characters];
-        let output = self.segment_replace(input, &dict_refs);
-        if punctuation {
-            Self::convert_punctuation(&output, "t")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::T2s, punctuation)
+            .convert(input)
     }
 
     pub fn s2tw(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [&self.dictionary.st_phrases, &self.dictionary.st_characters];
-        let dict_refs_round_2 = [&self.dictionary.tw_variants];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-        if punctuation {
-            Self::convert_punctuation(&output, "s")
-        } else {
-            output.to_string()
-        }
+        self.converter(OpenccConfig::S2tw, punctuation)
+            .convert(input)
     }
 
     pub fn tw2s(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [
-            &self.dictionary.tw_variants_rev_phrases,
-            &self.dictionary.tw_variants_rev,
-        ];
-        let dict_refs_round_2 = [&self.dictionary.ts_phrases, &self.dictionary.ts_characters];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-        if punctuation {
-            Self::convert_punctuation(&output, "t")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::Tw2s, punctuation)
+            .convert(input)
     }
 
     pub fn s2twp(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [&self.dictionary.st_phrases, &self.dictionary.st_characters];
-        let dict_refs_round_2 = [&self.dictionary.tw_phrases];
-        let dict_refs_round_3 = [&self.dictionary.tw_variants];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-        output = self.segment_replace(&output, &dict_refs_round_3);
-        if punctuation {
-            Self::convert_punctuation(&output, "s")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::S2twp, punctuation)
+            .convert(input)
     }
 
     pub fn tw2sp(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [
-            &self.dictionary.tw_variants_rev_phrases,
-            &self.dictionary.tw_variants_rev,
-        ];
-        let dict_refs_round_2 = [&self.dictionary.tw_phrases_rev];
-        let dict_refs_round_3 = [&self.dictionary.ts_phrases, &self.dictionary.ts_characters];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-        output = self.segment_replace(&output, &dict_refs_round_3);
-        if punctuation {
-            Self::convert_punctuation(&output, "t")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::Tw2sp, punctuation)
+            .convert(input)
     }
 
     pub fn s2hk(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [&self.dictionary.st_phrases, &self.dictionary.st_characters];
-        let dict_refs_round_2 = [&self.dictionary.hk_variants];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-        if punctuation {
-            Self::convert_punctuation(&output, "s")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::S2hk, punctuation)
+            .convert(input)
     }
 
     pub fn hk2s(&self, input: &str, punctuation: bool) -> String {
-        let dict_refs = [
-            &self.dictionary.hk_variants_rev_phrases,
-            &self.dictionary.hk_variants_rev,
-        ];
-        let dict_refs_round_2 = [&self.dictionary.ts_phrases, &self.dictionary.ts_characters];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-        if punctuation {
-            Self::convert_punctuation(&output, "t")
-        } else {
-            output
-        }
+        self.converter(OpenccConfig::Hk2s, punctuation)
+            .convert(input)
     }
 
     pub fn t2tw(&self, input: &str) -> String {
-        let dict_refs = [&self.dictionary.tw_variants];
-        let output = self.segment_replace(input, &dict_refs);
-
-        output
+        self.converter(OpenccConfig::T2tw, false).convert(input)
     }
 
     pub fn t2twp(&self, input: &str) -> String {
-        let dict_refs = [&self.dictionary.tw_phrases];
-        let dict_refs_round_2 = [&self.dictionary.tw_variants];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-
-        output
+        self.converter(OpenccConfig::T2twp, false).convert(input)
     }
 
     pub fn tw2t(&self, input: &str) -> String {
-        let dict_refs = [
-            &self.dictionary.tw_variants_rev_phrases,
-            &self.dictionary.tw_variants_rev,
-        ];
-        let output = self.segment_replace(input, &dict_refs);
-
-        output
+        self.converter(OpenccConfig::Tw2t, false).convert(input)
     }
 
     pub fn tw2tp(&self, input: &str) -> String {
-        let dict_refs = [
-            &self.dictionary.tw_variants_rev_phrases,
-            &self.dictionary.tw_variants_rev,
-        ];
-        let dict_refs_round_2 = [&self.dictionary.tw_phrases_rev];
-        let mut output = self.segment_replace(input, &dict_refs);
-        output = self.segment_replace(&output, &dict_refs_round_2);
-
-        output
+        self.converter(OpenccConfig::Tw2tp, false).convert(input)
     }
 
     pub fn t2hk(&self, input: &str) -> String {
-        let dict_refs = [&self.dictionary.hk_variants];
-        let output = self.segment_replace(input, &dict_refs);
-
-        output
+        self.converter(OpenccConfig::T2hk, false).convert(input)
     }
 
     pub fn hk2t(&self, input: &str) -> String {
-        let dict_refs = [
-            &self.dictionary.hk_variants_rev_phrases,
-            &self.dictionary.hk_variants_rev,
-        ];
-        let output = self.segment_replace(input, &dict_refs);
-
-        output
+        self.converter(OpenccConfig::Hk2t, false).convert(input)
     }
 
     pub fn t2jp(&self, input: &str) -> String {
-        let dict_refs = [&self.dictionary.jp_variants];
-        let output = self.segment_replace(input, &dict_refs);
-
-        output
+        self.converter(OpenccConfig::T2jp, false).convert(input)
     }
 
     pub fn jp2t(&self, input: &str) -> String {
-        let dict_refs = [
-            &self.dictionary.jps_phrases,
-            &self.dictionary.jps_characters,
-            &self.dictionary.jp_variants_rev,
-        ];
-        let output = self.segment_replace(input, &dict_refs);
-
-        output
+        self.converter(OpenccConfig::Jp2t, false).convert(input)
     }
 
     pub fn convert(&self, input: &str, config: &str, punctuation: bool) -> String {
-        let result;
-
-        match config.to_lowercase().as_str() {
-            "s2t" => result = self.s2t(input, punctuation),
-            "s2tw" => result = self.s2tw(input, punctuation),
-            "s2twp" => result = self.s2twp(input, punctuation),
-            "s2hk" => result = self.s2hk(input, punctuation),
-            "t2s" => result = self.t2s(input, punctuation),
-            "t2tw" => result = self.t2tw(input),
-            "t2twp" => result = self.t2twp(input),
-            "t2hk" => result = self.t2hk(input),
-            "tw2s" => result = self.tw2s(input, punctuation),
-            "tw2sp" => result = self.tw2sp(input, punctuation),
-            "tw2t" => result = self.tw2t(input),
-            "tw2tp" => result = self.tw2tp(input),
-            "hk2s" => result = self.hk2s(input, punctuation),
-            "hk2t" => result = self.hk2t(input),
-            "jp2t" => result = self.jp2t(input),
-            "t2jp" => result = self.t2jp(input),
-            _ => {
-                result = {
-                    OpenCC::set_last_error(format!("Invalid config: {}", config).as_str());
-                    String::new()
+        match OpenccConfig::from_name(config) {
+            Some(config) => self
+                .converter_for(config, punctuation, input)
+                .convert(input),
+            None => {
+                OpenCC::set_last_error(format!("Invalid config: {}", config).as_str());
+                String::new()
+            }
+        }
+    }
+
+    // Like convert, also returning the Spans aligning the output with the input
+    pub fn convert_with_spans(
+        &self,
+        input: &str,
+        config: &str,
+        punctuation: bool,
+    ) -> (String, Vec<Span>) {
+        match OpenccConfig::from_name(config) {
+            Some(config) => self
+                .converter_for(config, punctuation, input)
+                .convert_with_spans(input),
+            None => {
+                OpenCC::set_last_error(format!("Invalid config: {}", config).as_str());
+                (String::new(), Vec::new())
+            }
+        }
+    }
+
+    // Resolve a config once into its ordered dictionary rounds, so repeated conversions
+    // only run the segment/replace loop
+    pub fn converter(&self, config: OpenccConfig, punctuation: bool) -> Converter<'_> {
+        let mut rounds: Vec<DictRound> = config
+            .dict_rounds()
+            .iter()
+            .map(|round| {
+                let dictionaries = self.dictionary.round_tries(round);
+                let max_word_length = dictionaries
+                    .iter()
+                    .map(|dictionary| dictionary.max_length())
+                    .fold(1, std::cmp::max);
+                DictRound {
+                    ids: round,
+                    dictionaries,
+                    max_word_length,
                 }
+            })
+            .collect();
+        // The converter keeps the overlay version current now, if it touches any round;
+        // its tries join the rounds at conversion time, see Converter::rounds
+        let mut overlay = self.overlays.snapshot();
+        if let Some(current) = &overlay {
+            let mut used = false;
+            for round in &mut rounds {
+                for dictionary in current.tries(round.ids) {
+                    round.max_word_length = round.max_word_length.max(dictionary.max_length());
+                    used = true;
+                }
+            }
+            if !used {
+                overlay = None;
             }
         }
-        result
+        // Auto configs hold one converter per zho_check code
+        let targets = if config.is_auto() {
+            (0..3)
+                .map(|code| self.script_target(config, code, punctuation))
+                .collect()
+        } else {
+            Vec::new()
+        };
+        let punctuation = if punctuation {
+            config.punctuation_direction()
+        } else {
+            None
+        };
+
+        Converter {
+            opencc: self,
+            config,
+            rounds,
+            punctuation,
+            targets,
+            overlay,
+        }
     }
-    fn st(&self, input: &str) -> String {
-        let dict_refs = [&self.dictionary.st_characters];
-        let output = self.convert_by(input, &dict_refs, 1);
 
-        output
+    // Converter for converting `input` once. An auto config is resolved against `input`
+    // first, so only the target it picks is built rather than all of them.
+    pub fn converter_for(
+        &self,
+        config: OpenccConfig,
+        punctuation: bool,
+        input: &str,
+    ) -> Converter<'_> {
+        if config.is_auto() {
+            return self.script_target(config, self.zho_check(input), punctuation);
+        }
+        self.converter(config, punctuation)
     }
 
-    fn ts(&self, input: &str) -> String {
-        let dict_refs = [&self.dictionary.ts_characters];
-        let output = self.convert_by(input, &dict_refs, 1);
+    // The converter an auto config uses for input of zho_check `code`; one that leaves
+    // the input as is when the config has no target for it
+    fn script_target(&self, config: OpenccConfig, code: i32, punctuation: bool) -> Converter<'_> {
+        match config.for_script(code) {
+            Some(target) => self.converter(target, punctuation),
+            None => Converter {
+                opencc: self,
+                config,
+                rounds: Vec::new(),
+                punctuation: None,
+                targets: Vec::new(),
+                overlay: None,
+            },
+        }
+    }
 
-        output
+    // Load the tables of a config (and of its targets, for an auto config) now rather
+    // than at its first conversion
+    pub fn preload(&self, config: OpenccConfig) -> Result<(), Box<dyn Error>> {
+        if config.is_auto() {
+            for target in (0..3).filter_map(|code| config.for_script(code)) {
+                self.preload(target)?;
+            }
+            return Ok(());
+        }
+        for round in config.dict_rounds() {
+            self.dictionary.preload(round)?;
+        }
+        // Builds the merged trie of every multi-table round
+        self.converter(config, false);
+        Ok(())
     }
 
+    // Incremental converter for input that arrives in pieces, see ConversionStream
+    pub fn stream(&self, config: OpenccConfig, punctuation: bool) -> ConversionStream<'_> {
+        ConversionStream::new(self.converter(config, punctuation))
+    }
+
+    // 1: Traditional, 2: Simplified, 0: neither (or empty)
     pub fn zho_check(&self, input: &str) -> i32 {
-        if input.is_empty() {
-            return 0;
-        }
-        // let re = Regex::new(r"[!-/:-@\[-`{-~\t\n\v\f\r 0-9A-Za-z_]").unwrap();
-        let _strip_text = STRIP_REGEX.replace_all(input, "");
-        let max_bytes = find_max_utf8_length(&_strip_text, 200);
-        let strip_text = &_strip_text[..max_bytes];
-        let code;
-        if strip_text != &self.ts(strip_text) {
-            code = 1;
-        } else {
-            if strip_text != &self.st(strip_text) {
-                code = 2;
-            } else {
-                code = 0;
+        self.zho_check_with_confidence(input).0
+    }
+
+    // zho_check together with a confidence in [0, 1]: the share of the script-specific
+    // chars in the scanned prefix that agree with the verdict (0 when there are none).
+    // Only the first ZHO_CHECK_BYTES bytes of non-ASCII text are looked at, in a single
+    // pass over per-codepoint flags and without allocating.
+    pub fn zho_check_with_confidence(&self, input: &str) -> (i32, f64) {
+        let mut scan = ScriptScan::default();
+        self.scan_script(&mut scan, input);
+        scan.verdict()
+    }
+
+    // Continue a zho_check scan over `input`, the text following what `scan` has seen
+    pub(crate) fn scan_script(&self, scan: &mut ScriptScan, input: &str) {
+        if scan.settled {
+            return;
+        }
+        let ts = self.dictionary.trie(DictId::TsCharacters);
+        let st = self.dictionary.trie(DictId::StCharacters);
+        for ch in input.chars() {
+            // ASCII letters, digits, punctuation and whitespace say nothing about the script
+            if ch.is_ascii_graphic() || ch == ' ' || ('\t'..='\r').contains(&ch) {
+                continue;
+            }
+            scan.scanned += ch.len_utf8();
+            if scan.scanned > ZHO_CHECK_BYTES {
+                scan.settled = true;
+                return;
+            }
+            if ts.remaps(ch) {
+                scan.traditional += 1;
+            } else if st.remaps(ch) {
+                scan.simplified_only += 1;
             }
         }
-        code
     }
 
-    fn convert_punctuation(sv: &str, config: &str) -> String {
-        let mut s2t_punctuation_chars: HashMap<&str, &str> = HashMap::new();
-        s2t_punctuation_chars.insert("“", "「");
-        s2t_punctuation_chars.insert("”", "」");
-        s2t_punctuation_chars.insert("‘", "『");
-        s2t_punctuation_chars.insert("’", "』");
-
-        let output_text;
+    // Swap quote marks in place. Each pair has the same UTF-8 width, so the rewrite
+    // never moves the surrounding text.
+    fn convert_punctuation(text: &mut String, direction: &str) {
+        Self::convert_punctuation_observed(text, direction, |_| {});
+    }
 
-        if config.starts_with('s') {
-            let s2t_pattern = s2t_punctuation_chars.keys().cloned().collect::<String>();
-            let s2t_regex = Regex::new(&format!("[{}]", s2t_pattern)).unwrap();
-            output_text = s2t_regex
-                .replace_all(sv, |caps: &regex::Captures| {
-                    s2t_punctuation_chars[caps.get(0).unwrap().as_str()]
-                })
-                .into_owned();
+    // convert_punctuation, passing the byte offset of every quote mark replaced
+    fn convert_punctuation_observed(
+        text: &mut String,
+        direction: &str,
+        mut replaced: impl FnMut(usize),
+    ) {
+        let table = if direction.starts_with('s') {
+            &PUNCTUATION_TABLES[0]
         } else {
-            let mut t2s_punctuation_chars: HashMap<&str, &str> = HashMap::new();
-            for (key, value) in s2t_punctuation_chars.iter() {
-                t2s_punctuation_chars.insert(value, key);
+            &PUNCTUATION_TABLES[1]
+        };
+        // SAFETY: only whole 3-byte sequences are overwritten, each by another one
+        let bytes = unsafe { text.as_bytes_mut() };
+        let mut pos = 0;
+        while let Some(offset) = bytes[pos..].iter().position(|&byte| byte == table.lead) {
+            pos += offset;
+            let Some(sequence) = bytes.get(pos..pos + 3) else {
+                break;
+            };
+            match table.pairs.iter().find(|(from, _)| from[..] == *sequence) {
+                Some((_, to)) => {
+                    bytes[pos..pos + 3].copy_from_slice(to);
+                    replaced(pos);
+                    pos += 3;
+                }
+                None => pos += 1,
             }
-            let t2s_pattern = t2s_punctuation_chars.keys().cloned().collect::<String>();
-            let t2s_regex = Regex::new(&format!("[{}]", t2s_pattern)).unwrap();
-            output_text = t2s_regex
-                .replace_all(sv, |caps: &regex::Captures| {
-                    t2s_punctuation_chars[caps.get(0).unwrap().as_str()]
-                })
-                .into_owned();
         }
-        output_text
     }
 
     // Function to set the last error message
     pub fn set_last_error(err_msg: &str) {
-        let mut last_error = LAST_ERROR.lock().unwrap();
-        *last_error = Some(err_msg.to_string());
+        LAST_ERROR.with(|last_error| *last_error.borrow_mut() = Some(err_msg.to_string()));
     }
 
     // Function to retrieve the last error message
     pub fn get_last_error() -> Option<String> {
-        let last_error = LAST_ERROR.lock().unwrap();
-        last_error.clone()
+        LAST_ERROR.with(|last_error| last_error.borrow().clone())
+    }
+
+    // Retrieve the last error message and clear it
+    pub fn take_last_error() -> Option<String> {
+        LAST_ERROR.with(|last_error| last_error.borrow_mut().take())
+    }
+}
+
+// One compile-time plan per built-in config, generated with OpenccConfig itself from
+// the table below: its name, dictionary rounds and punctuation direction
+struct ConversionPlan {
+    name: &'static str,
+    rounds: &'static [&'static [DictId]],
+    punctuation: Option<&'static str>,
+}
+
+macro_rules! conversion_plans {
+    ($($config:ident => $name:literal, [$([$($id:ident),+]),*], $punctuation:expr;)+) => {
+        #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+        pub enum OpenccConfig {
+            $($config,)+
+        }
+
+        const CONVERSION_PLANS: &[ConversionPlan] = &[$(ConversionPlan {
+            name: $name,
+            rounds: &[$(&[$(DictId::$id),+]),*],
+            punctuation: $punctuation,
+        },)+];
+
+        impl OpenccConfig {
+            pub const ALL: [OpenccConfig; CONVERSION_PLANS.len()] = [$(OpenccConfig::$config,)+];
+        }
+    };
+}
+
+// Punctuation is converted by Simplified/Traditional configs only. The auto configs
+// have no rounds of their own; they are resolved per input, see for_script.
+conversion_plans! {
+    S2t => "s2t", [[StPhrases, StCharacters]], Some("s");
+    S2tw => "s2tw", [[StPhrases, StCharacters], [TwVariants]], Some("s");
+    S2twp => "s2twp", [[StPhrases, StCharacters], [TwPhrases], [TwVariants]], Some("s");
+    S2hk => "s2hk", [[StPhrases, StCharacters], [HkVariants]], Some("s");
+    T2s => "t2s", [[TsPhrases, TsCharacters]], Some("t");
+    T2tw => "t2tw", [[TwVariants]], None;
+    T2twp => "t2twp", [[TwPhrases], [TwVariants]], None;
+    T2hk => "t2hk", [[HkVariants]], None;
+    Tw2s => "tw2s", [[TwVariantsRevPhrases, TwVariantsRev], [TsPhrases, TsCharacters]], Some("t");
+    Tw2sp => "tw2sp",
+        [[TwVariantsRevPhrases, TwVariantsRev], [TwPhrasesRev], [TsPhrases, TsCharacters]],
+        Some("t");
+    Tw2t => "tw2t", [[TwVariantsRevPhrases, TwVariantsRev]], None;
+    Tw2tp => "tw2tp", [[TwVariantsRevPhrases, TwVariantsRev], [TwPhrasesRev]], None;
+    Hk2s => "hk2s", [[HkVariantsRevPhrases, HkVariantsRev], [TsPhrases, TsCharacters]], Some("t");
+    Hk2t => "hk2t", [[HkVariantsRevPhrases, HkVariantsRev]], None;
+    Jp2t => "jp2t", [[JpsPhrases, JpsCharacters, JpVariantsRev]], None;
+    T2jp => "t2jp", [[JpVariants]], None;
+    Auto2t => "auto2t", [], None;
+    Auto2tw => "auto2tw", [], None;
+    Auto2twp => "auto2twp", [], None;
+    Auto2hk => "auto2hk", [], None;
+    Auto2s => "auto2s", [], None;
+}
+
+// Most dictionary rounds of any built-in config
+pub(crate) const fn max_plan_rounds() -> usize {
+    let mut max = 0;
+    let mut index = 0;
+    while index < CONVERSION_PLANS.len() {
+        if CONVERSION_PLANS[index].rounds.len() > max {
+            max = CONVERSION_PLANS[index].rounds.len();
+        }
+        index += 1;
+    }
+    max
+}
+
+impl OpenccConfig {
+    // Case-insensitive lookup of a config name such as "s2twp"
+    pub fn from_name(config: &str) -> Option<Self> {
+        Self::ALL
+            .iter()
+            .copied()
+            .find(|c| c.as_str().eq_ignore_ascii_case(config))
+    }
+
+    pub fn as_str(self) -> &'static str {
+        self.plan().name
+    }
+
+    pub fn is_auto(self) -> bool {
+        matches!(
+            self,
+            OpenccConfig::Auto2t
+                | OpenccConfig::Auto2tw
+                | OpenccConfig::Auto2twp
+                | OpenccConfig::Auto2hk
+                | OpenccConfig::Auto2s
+        )
+    }
+
+    // The config an auto config applies to input of the given zho_check code; None
+    // leaves the input unchanged. Other configs map to themselves.
+    pub fn for_script(self, code: i32) -> Option<OpenccConfig> {
+        let (simplified, traditional) = match self {
+            OpenccConfig::Auto2t => (Some(OpenccConfig::S2t), None),
+            OpenccConfig::Auto2tw => (Some(OpenccConfig::S2tw), Some(OpenccConfig::T2tw)),
+            OpenccConfig::Auto2twp => (Some(OpenccConfig::S2twp), Some(OpenccConfig::T2twp)),
+            OpenccConfig::Auto2hk => (Some(OpenccConfig::S2hk), Some(OpenccConfig::T2hk)),
+            OpenccConfig::Auto2s => (None, Some(OpenccConfig::T2s)),
+            config => return Some(config),
+        };
+        match code {
+            1 => traditional,
+            2 => simplified,
+            _ => None,
+        }
+    }
+
+    fn plan(self) -> &'static ConversionPlan {
+        &CONVERSION_PLANS[self as usize]
+    }
+
+    // Ordered dictionary rounds; each round is one segment/replace pass over the text
+    fn dict_rounds(self) -> &'static [&'static [DictId]] {
+        self.plan().rounds
+    }
+
+    fn punctuation_direction(self) -> Option<&'static str> {
+        self.plan().punctuation
+    }
+}
+
+// UTF-8 form of one punctuation direction. Every source mark starts with the same lead
+// byte, which is all the scan has to look for.
+struct PunctuationTable {
+    lead: u8,
+    pairs: Vec<([u8; 3], [u8; 3])>,
+}
+
+impl PunctuationTable {
+    fn new(pairs: impl Iterator<Item = (char, char)>) -> Self {
+        let encode = |ch: char| {
+            let mut bytes = [0; 3];
+            ch.encode_utf8(&mut bytes);
+            bytes
+        };
+        let pairs: Vec<_> = pairs.map(|(from, to)| (encode(from), encode(to))).collect();
+        let lead = pairs[0].0[0];
+        debug_assert!(pairs.iter().all(|(from, _)| from[0] == lead));
+        PunctuationTable { lead, pairs }
+    }
+}
+
+#[derive(Clone)]
+struct DictRound<'a> {
+    ids: &'static [DictId],
+    dictionaries: Vec<&'a Trie>,
+    max_word_length: usize,
+}
+
+// A config resolved against an OpenCC instance: dictionary rounds, merged max word
+// length per round and punctuation mode are fixed at construction
+pub struct Converter<'a> {
+    opencc: &'a OpenCC,
+    config: OpenccConfig,
+    rounds: Vec<DictRound<'a>>,
+    punctuation: Option<&'static str>,
+    // Auto configs only: the converter for each zho_check code
+    targets: Vec<Converter<'a>>,
+    // User overlays current when the converter was made, if they cover any of `rounds`
+    // (whose max word lengths already include them)
+    overlay: Option<Arc<Overlays>>,
+}
+
+impl<'a> Converter<'a> {
+    pub fn config(&self) -> OpenccConfig {
+        self.config
+    }
+
+    // The rounds to run, each with its overlay tries ahead of the built-in ones. The
+    // overlay tries belong to `overlay`, so rounds that include them are put together
+    // per call; without overlays these are `rounds` as they are.
+    fn rounds(&self) -> Cow<'_, [DictRound<'_>]> {
+        let overlay = match &self.overlay {
+            Some(overlay) => overlay,
+            None => return Cow::Borrowed(&self.rounds),
+        };
+        let rounds = self.rounds.iter().map(|round| {
+            let mut dictionaries: Vec<&Trie> = overlay.tries(round.ids).collect();
+            dictionaries.extend(&round.dictionaries);
+            DictRound {
+                dictionaries,
+                ..*round
+            }
+        });
+        Cow::Owned(rounds.collect())
+    }
+
+    pub fn convert(&self, input: &str) -> String {
+        let mut output = String::new();
+        self.convert_to(input, &mut output);
+        output
+    }
+
+    // Convert into `output`, replacing its contents. Reusing one buffer across calls
+    // keeps serial conversions free of allocations.
+    pub fn convert_to(&self, input: &str, output: &mut String) {
+        if self.is_auto() {
+            return self.target_for(input).convert_to(input, output);
+        }
+        if self.opencc.stats.is_enabled() {
+            return self.convert_instrumented(input, output);
+        }
+        let cached = self.cache_lookup(input, output);
+        if let Lookup::Hit = cached {
+            return;
+        }
+        output.clear();
+        match &*self.rounds() {
+            [] => output.push_str(input),
+            [round] => self.opencc.segment_replace(
+                input,
+                &round.dictionaries,
+                round.max_word_length,
+                output,
+            ),
+            rounds => self.opencc.segment_replace_rounds(input, rounds, output),
+        }
+        if let Some(direction) = self.punctuation {
+            OpenCC::convert_punctuation(output, direction);
+        }
+        self.cache_insert(cached, input, output);
+    }
+
+    // Convert many (typically short) strings. With parallelism enabled the work is
+    // spread across items, and each item is converted serially on its worker.
+    pub fn convert_batch(&self, inputs: &[&str]) -> Vec<String> {
+        let policy = self.opencc.parallel_policy();
+        let total: usize = inputs.iter().map(|input| input.len()).sum();
+        if inputs.len() > 1 && policy.is_parallel_for(total) {
+            policy.install(|| {
+                inputs
+                    .par_iter()
+                    .map(|input| self.convert_serial(input))
+                    .collect()
+            })
+        } else {
+            inputs
+                .iter()
+                .map(|input| self.convert_serial(input))
+                .collect()
+        }
+    }
+
+    // Auto configs resolve each input to one of their targets
+    fn is_auto(&self) -> bool {
+        !self.targets.is_empty()
+    }
+
+    // Auto configs: the converter picked by the script of `input`
+    fn target_for(&self, input: &str) -> &Converter<'a> {
+        &self.targets[self.opencc.zho_check(input) as usize]
+    }
+
+    fn convert_serial(&self, input: &str) -> String {
+        if self.is_auto() {
+            return self.target_for(input).convert_serial(input);
+        }
+        if self.opencc.stats.is_enabled() {
+            let mut output = String::new();
+            self.convert_instrumented(input, &mut output);
+            return output;
+        }
+        let mut output = String::new();
+        let cached = self.cache_lookup(input, &mut output);
+        if let Lookup::Hit = cached {
+            return output;
+        }
+        let output = if self.rounds.is_empty() {
+            input.to_string()
+        } else {
+            self.opencc
+                .segment_replace_rounds_serial(input, &self.rounds())
+        };
+        let output = self.apply_punctuation(output);
+        self.cache_insert(cached, input, &output);
+
+        output
+    }
+
+    fn cache_key(&self) -> CacheKey {
+        CacheKey {
+            config: self.config,
+            punctuation: self.punctuation.is_some(),
+            overlay: self
+                .overlay
+                .as_ref()
+                .map_or(0, |overlay| overlay.generation),
+        }
+    }
+
+    fn cache_lookup(&self, input: &str, output: &mut String) -> Lookup {
+        self.opencc.cache.lookup(self.cache_key(), input, output)
+    }
+
+    fn cache_insert(&self, cached: Lookup, input: &str, output: &str) {
+        if let Lookup::Miss(hash) = cached {
+            self.opencc
+                .cache
+                .insert(hash, self.cache_key(), input, output);
+        }
+    }
+
+    // Serial round-by-round conversion that records its counters; gives the same
+    // output as the fused path
+    fn convert_instrumented(&self, input: &str, output: &mut String) {
+        let opencc = self.opencc;
+        let mut counts = CallCounts::new(input.len());
+        output.clear();
+        output.push_str(input);
+        let mut next = String::with_capacity(input.len());
+        for (index, round) in self.rounds().iter().enumerate() {
+            let started = std::time::Instant::now();
+            let mut matches = MatchCounts::default();
+            next.clear();
+            let chunks = self.convert_round_observed(output, round, &mut next, &mut matches);
+            if index == 0 {
+                counts.chunks = chunks;
+            }
+            std::mem::swap(output, &mut next);
+            counts.rounds[index] = (started.elapsed().as_nanos() as u64, matches);
+        }
+        if let Some(direction) = self.punctuation {
+            OpenCC::convert_punctuation(output, direction);
+        }
+        counts.bytes_out = output.len();
+        opencc.stats.record(self.config, &counts);
+    }
+
+    // Convert, also returning the Spans that align each dictionary match in the output
+    // with the input, composed across rounds. Runs serially, round by round.
+    pub fn convert_with_spans(&self, input: &str) -> (String, Vec<Span>) {
+        if self.is_auto() {
+            return self.target_for(input).convert_with_spans(input);
+        }
+        let mut output = input.to_string();
+        let mut next = String::with_capacity(input.len());
+        let mut spans: Option<Vec<Span>> = None;
+        for round in self.rounds().iter() {
+            let mut recorder = SpanRecorder::new(&output);
+            next.clear();
+            self.convert_round_observed(&output, round, &mut next, &mut recorder);
+            std::mem::swap(&mut output, &mut next);
+            spans = Some(match spans {
+                Some(previous) => spans::compose(&previous, &recorder.spans),
+                None => recorder.spans,
+            });
+        }
+        // Each replaced quote mark is a span of its own, 3 bytes to 3 bytes
+        if let Some(direction) = self.punctuation {
+            let mut quotes = Vec::new();
+            OpenCC::convert_punctuation_observed(&mut output, direction, |offset| {
+                quotes.push(Span {
+                    src_offset: offset,
+                    src_len: 3,
+                    dst_offset: offset,
+                    dst_len: 3,
+                })
+            });
+            spans = Some(match spans {
+                Some(previous) => spans::compose(&previous, &quotes),
+                None => quotes,
+            });
+        }
+
+        (output, spans.unwrap_or_default())
+    }
+
+    // One serial pass of a round over `text`, telling `observer` about every step;
+    // returns the number of chunks
+    fn convert_round_observed<O: MatchObserver>(
+        &self,
+        text: &str,
+        round: &DictRound,
+        output: &mut String,
+        observer: &mut O,
+    ) -> usize {
+        let opencc = self.opencc;
+        let mut chunks = 0;
+        for chunk in opencc.delimiters.split_inclusive(text) {
+            chunks += 1;
+            let mut chars = chunk.chars();
+            match (chars.next(), chars.next()) {
+                (Some(ch), None) if opencc.delimiters.contains(ch) => output.push(ch),
+                _ => {
+                    opencc.convert_prefix_observed(
+                        chunk,
+                        &round.dictionaries,
+                        round.max_word_length,
+                        output,
+                        false,
+                        observer,
+                    );
+                }
+            }
+        }
+        chunks
+    }
+
+    fn apply_punctuation(&self, mut output: String) -> String {
+        if let Some(direction) = self.punctuation {
+            OpenCC::convert_punctuation(&mut output, direction);
+        }
+        output
     }
 }
 
@@ -0,0 +1,148 @@
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
+
+use crate::dictionary_lib::{DictId, Trie};
+
+// User entries layered over the built-in tables of one handle. Updates are published
+// copy-on-write: a new version is built beside the current one and the pointer is
+// swapped, so conversions holding the old version keep running undisturbed.
+pub(crate) struct OverlayStore {
+    // Lets handles without overlays skip the lock
+    active: AtomicBool,
+    current: RwLock<Option<Arc<Overlays>>>,
+    // Serializes writers so concurrent updates do not drop each other's entries
+    update: Mutex<u64>,
+}
+
+pub(crate) struct Overlays {
+    // Distinguishes versions, e.g. in the conversion cache key
+    pub(crate) generation: u64,
+    // Unchanged tables are shared between versions
+    tables: [Option<Arc<OverlayTable>>; 16],
+}
+
+// Entries added to a table since its last full rebuild form a delta layer, so an update
+// only rebuilds the trie of those. The delta is merged into the base layer once it
+// outgrows this many entries or a quarter of the base, whichever is larger.
+const MERGE_DELTA_LEN: usize = 4096;
+
+struct OverlayTable {
+    // Consulted ahead of `base`, so its entries replace the same keys there
+    delta: Option<OverlayLayer>,
+    base: Arc<OverlayLayer>,
+}
+
+struct OverlayLayer {
+    entries: (HashMap<String, String>, usize),
+    trie: Trie,
+}
+
+impl Overlays {
+    // Overlay tries for the tables of a round, in round order
+    pub(crate) fn tries<'s>(&'s self, ids: &'s [DictId]) -> impl Iterator<Item = &'s Trie> {
+        ids.iter()
+            .filter_map(|&id| self.tables[id as usize].as_ref())
+            .flat_map(|table| table.delta.iter().chain([&*table.base]))
+            .map(|layer| &layer.trie)
+    }
+}
+
+impl OverlayTable {
+    // The table after adding `entries`: they go into the delta layer, and the base is
+    // rebuilt only when the delta has grown too large
+    fn with(existing: Option<&OverlayTable>, entries: HashMap<String, String>) -> Self {
+        let existing = match existing {
+            Some(existing) => existing,
+            None => {
+                return OverlayTable {
+                    delta: None,
+                    base: Arc::new(OverlayLayer::new(entries)),
+                }
+            }
+        };
+        let mut delta = match &existing.delta {
+            Some(delta) => delta.entries.0.clone(),
+            None => HashMap::new(),
+        };
+        delta.extend(entries);
+        if delta.len() <= MERGE_DELTA_LEN.max(existing.base.entries.0.len() / 4) {
+            return OverlayTable {
+                delta: Some(OverlayLayer::new(delta)),
+                base: Arc::clone(&existing.base),
+            };
+        }
+        let mut merged = existing.base.entries.0.clone();
+        merged.extend(delta);
+        OverlayTable {
+            delta: None,
+            base: Arc::new(OverlayLayer::new(merged)),
+        }
+    }
+}
+
+impl OverlayLayer {
+    fn new(entries: HashMap<String, String>) -> Self {
+        let max_length = entries
+            .keys()
+            .map(|key| key.chars().count())
+            .fold(1, std::cmp::max);
+        let entries = (entries, max_length);
+        let trie = Trie::from_dictionary(&entries);
+        OverlayLayer { entries, trie }
+    }
+}
+
+impl OverlayStore {
+    pub(crate) fn new() -> Self {
+        OverlayStore {
+            active: AtomicBool::new(false),
+            current: RwLock::new(None),
+            update: Mutex::new(0),
+        }
+    }
+
+    pub(crate) fn snapshot(&self) -> Option<Arc<Overlays>> {
+        if !self.active.load(Ordering::Acquire) {
+            return None;
+        }
+        self.current.read().unwrap().clone()
+    }
+
+    // Add (or replace) entries of one table; only that table's delta layer is rebuilt,
+    // or its whole overlay when the delta is due to be merged
+    pub(crate) fn add(&self, table: DictId, entries: HashMap<String, String>) {
+        let mut generation = self.update.lock().unwrap();
+        let mut tables = match self.current.read().unwrap().as_ref() {
+            Some(current) => current.tables.clone(),
+            None => Default::default(),
+        };
+        let updated = OverlayTable::with(tables[table as usize].as_deref(), entries);
+        tables[table as usize] = Some(Arc::new(updated));
+        *generation += 1;
+        self.publish(Some(Arc::new(Overlays {
+            generation: *generation,
+            tables,
+        })));
+    }
+
+    pub(crate) fn clear(&self) {
+        let _generation = self.update.lock().unwrap();
+        self.publish(None);
+    }
+
+    // Copy of another store's current version, for a cloned handle
+    pub(crate) fn copy_from(&self, other: &OverlayStore) {
+        let mut generation = self.update.lock().unwrap();
+        let current = other.snapshot();
+        *generation = current.as_ref().map_or(0, |overlays| overlays.generation);
+        self.publish(current);
+    }
+
+    fn publish(&self, overlays: Option<Arc<Overlays>>) {
+        let active = overlays.is_some();
+        // The old version is dropped once its last conversion finishes
+        let _previous = std::mem::replace(&mut *self.current.write().unwrap(), overlays);
+        self.active.store(active, Ordering::Release);
+    }
+}
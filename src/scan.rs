@@ -0,0 +1,267 @@
+// Byte-level scanning helpers for segmentation: a bitmap char set used for the
+// delimiters and for the first chars of dictionary keys, and a vectorized scan for
+// runs of ASCII letters and digits.
+
+// Set of chars as bitmaps: one bit per ASCII and BMP codepoint, plus the sorted
+// supplementary-plane members. `lead` marks the UTF-8 first byte of every non-ASCII
+// member, so a scan can step over other chars without decoding them.
+pub(crate) struct CharSet {
+    ascii: u128,
+    bmp: Box<[u64; 1024]>,
+    supplementary: Vec<u32>,
+    lead: [u64; 4],
+}
+
+impl CharSet {
+    pub(crate) fn new(chars: impl IntoIterator<Item = char>) -> Self {
+        let mut set = CharSet {
+            ascii: 0,
+            bmp: Box::new([0; 1024]),
+            supplementary: Vec::new(),
+            lead: [0; 4],
+        };
+        for ch in chars {
+            let code = ch as u32;
+            if code < 0x80 {
+                set.ascii |= 1 << code;
+            } else {
+                let mut bytes = [0; 4];
+                let lead = ch.encode_utf8(&mut bytes).as_bytes()[0];
+                set.lead[lead as usize >> 6] |= 1 << (lead & 63);
+                if code <= 0xFFFF {
+                    set.bmp[code as usize >> 6] |= 1 << (code & 63);
+                } else {
+                    set.supplementary.push(code);
+                }
+            }
+        }
+        set.supplementary.sort_unstable();
+        set.supplementary.dedup();
+        set
+    }
+
+    #[inline]
+    pub(crate) fn contains(&self, ch: char) -> bool {
+        let code = ch as u32;
+        if code < 0x80 {
+            self.ascii & (1 << code) != 0
+        } else if code <= 0xFFFF {
+            self.bmp[code as usize >> 6] & (1 << (code & 63)) != 0
+        } else {
+            self.supplementary.binary_search(&code).is_ok()
+        }
+    }
+
+    // Whether any ASCII letter or digit is a member
+    pub(crate) fn contains_ascii_alnum(&self) -> bool {
+        const ALNUM: u128 = (0x3FF << b'0') | (0x3FF_FFFF << b'A') | (0x3FF_FFFF << b'a');
+        self.ascii & ALNUM != 0
+    }
+
+    // Byte length of the first chunk of `text`: up to and including the first member,
+    // or all of `text` when there is none
+    pub(crate) fn chunk_len(&self, text: &str) -> usize {
+        self.chunk_end(text).unwrap_or(text.len())
+    }
+
+    // Byte offset just past the first member in `text`
+    pub(crate) fn chunk_end(&self, text: &str) -> Option<usize> {
+        let bytes = text.as_bytes();
+        let skip_alnum = !self.contains_ascii_alnum();
+        let mut pos = 0;
+        while pos < bytes.len() {
+            let byte = bytes[pos];
+            if byte < 0x80 {
+                if self.ascii & (1 << byte) != 0 {
+                    return Some(pos + 1);
+                }
+                pos += if skip_alnum {
+                    ascii_alnum_run(&bytes[pos..]).max(1)
+                } else {
+                    1
+                };
+            } else {
+                let width = utf8_width(byte);
+                if self.lead[byte as usize >> 6] & (1 << (byte & 63)) != 0 {
+                    let ch = text[pos..].chars().next().unwrap();
+                    if self.contains(ch) {
+                        return Some(pos + width);
+                    }
+                }
+                pos += width;
+            }
+        }
+        None
+    }
+
+    // Same chunks as `text.split_inclusive(|c| self.contains(c))`
+    pub(crate) fn split_inclusive<'s, 't>(&'s self, text: &'t str) -> SplitInclusive<'s, 't> {
+        SplitInclusive { set: self, text }
+    }
+}
+
+pub(crate) struct SplitInclusive<'s, 't> {
+    set: &'s CharSet,
+    text: &'t str,
+}
+
+impl<'s, 't> Iterator for SplitInclusive<'s, 't> {
+    type Item = &'t str;
+
+    fn next(&mut self) -> Option<&'t str> {
+        if self.text.is_empty() {
+            return None;
+        }
+        let (chunk, rest) = self.text.split_at(self.set.chunk_len(self.text));
+        self.text = rest;
+        Some(chunk)
+    }
+}
+
+#[inline]
+fn utf8_width(lead: u8) -> usize {
+    match lead {
+        0xF0.. => 4,
+        0xE0.. => 3,
+        _ => 2,
+    }
+}
+
+// Length of the run of ASCII letters and digits at the start of `bytes`
+#[inline]
+pub(crate) fn ascii_alnum_run(bytes: &[u8]) -> usize {
+    if bytes.len() < 16 {
+        return ascii_alnum_run_scalar(bytes);
+    }
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            return unsafe { ascii_alnum_run_avx2(bytes) };
+        }
+        // SSE2 is part of the x86_64 baseline
+        unsafe { ascii_alnum_run_sse2(bytes) }
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        // NEON is part of the aarch64 baseline
+        unsafe { ascii_alnum_run_neon(bytes) }
+    }
+    #[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+    {
+        ascii_alnum_run_scalar(bytes)
+    }
+}
+
+fn ascii_alnum_run_scalar(bytes: &[u8]) -> usize {
+    bytes
+        .iter()
+        .position(|byte| !byte.is_ascii_alphanumeric())
+        .unwrap_or(bytes.len())
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn ascii_alnum_run_avx2(bytes: &[u8]) -> usize {
+    use std::arch::x86_64::*;
+    // Signed compares: bytes >= 0x80 are negative and fail every range test
+    let digit_low = _mm256_set1_epi8(b'0' as i8 - 1);
+    let digit_high = _mm256_set1_epi8(b'9' as i8 + 1);
+    let alpha_low = _mm256_set1_epi8(b'a' as i8 - 1);
+    let alpha_high = _mm256_set1_epi8(b'z' as i8 + 1);
+    let case_bit = _mm256_set1_epi8(0x20);
+    let mut pos = 0;
+    while pos + 32 <= bytes.len() {
+        let v = _mm256_loadu_si256(bytes.as_ptr().add(pos) as *const __m256i);
+        let digit = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, digit_low),
+            _mm256_cmpgt_epi8(digit_high, v),
+        );
+        let folded = _mm256_or_si256(v, case_bit);
+        let alpha = _mm256_and_si256(
+            _mm256_cmpgt_epi8(folded, alpha_low),
+            _mm256_cmpgt_epi8(alpha_high, folded),
+        );
+        let mask = _mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) as u32;
+        if mask != u32::MAX {
+            return pos + mask.trailing_ones() as usize;
+        }
+        pos += 32;
+    }
+    pos + ascii_alnum_run_scalar(&bytes[pos..])
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "sse2")]
+unsafe fn ascii_alnum_run_sse2(bytes: &[u8]) -> usize {
+    use std::arch::x86_64::*;
+    let digit_low = _mm_set1_epi8(b'0' as i8 - 1);
+    let digit_high = _mm_set1_epi8(b'9' as i8 + 1);
+    let alpha_low = _mm_set1_epi8(b'a' as i8 - 1);
+    let alpha_high = _mm_set1_epi8(b'z' as i8 + 1);
+    let case_bit = _mm_set1_epi8(0x20);
+    let mut pos = 0;
+    while pos + 16 <= bytes.len() {
+        let v = _mm_loadu_si128(bytes.as_ptr().add(pos) as *const __m128i);
+        let digit = _mm_and_si128(_mm_cmpgt_epi8(v, digit_low), _mm_cmpgt_epi8(digit_high, v));
+        let folded = _mm_or_si128(v, case_bit);
+        let alpha = _mm_and_si128(
+            _mm_cmpgt_epi8(folded, alpha_low),
+            _mm_cmpgt_epi8(alpha_high, folded),
+        );
+        let mask = _mm_movemask_epi8(_mm_or_si128(digit, alpha)) as u32;
+        if mask != 0xFFFF {
+            return pos + mask.trailing_ones() as usize;
+        }
+        pos += 16;
+    }
+    pos + ascii_alnum_run_scalar(&bytes[pos..])
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn ascii_alnum_run_neon(bytes: &[u8]) -> usize {
+    use std::arch::aarch64::*;
+    let case_bit = vdupq_n_u8(0x20);
+    let mut pos = 0;
+    while pos + 16 <= bytes.len() {
+        let v = vld1q_u8(bytes.as_ptr().add(pos));
+        let digit = vandq_u8(vcgeq_u8(v, vdupq_n_u8(b'0')), vcleq_u8(v, vdupq_n_u8(b'9')));
+        let folded = vorrq_u8(v, case_bit);
+        let alpha = vandq_u8(
+            vcgeq_u8(folded, vdupq_n_u8(b'a')),
+            vcleq_u8(folded, vdupq_n_u8(b'z')),
+        );
+        // No movemask on NEON: locate the end of the run within this block by hand
+        if vminvq_u8(vorrq_u8(digit, alpha)) != 0xFF {
+            return pos + ascii_alnum_run_scalar(&bytes[pos..pos + 16]);
+        }
+        pos += 16;
+    }
+    pos + ascii_alnum_run_scalar(&bytes[pos..])
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn ascii_alnum_run_matches_scalar() {
+        let text = "abcXYZ0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ@[`{/:";
+        for start in 0..text.len() {
+            for end in start..=text.len() {
+                let bytes = &text.as_bytes()[start..end];
+                assert_eq!(ascii_alnum_run(bytes), ascii_alnum_run_scalar(bytes));
+            }
+        }
+        let mixed = "0123456789abcdef汉字0123456789abcdefghijklmnopqrstuvwxyz0123";
+        assert_eq!(ascii_alnum_run(mixed.as_bytes()), 16);
+    }
+
+    #[test]
+    fn split_inclusive_matches_str() {
+        let set = CharSet::new("，。 ,.\u{20000}".chars());
+        let text = "龙马，精神。 hello, world.汉𠀀字 end";
+        let expected: Vec<&str> = text.split_inclusive(|c| set.contains(c)).collect();
+        assert_eq!(set.split_inclusive(text).collect::<Vec<_>>(), expected);
+        assert_eq!(expected.len(), 9);
+    }
+}
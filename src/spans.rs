@@ -0,0 +1,88 @@
+use crate::stats::MatchObserver;
+
+// A dictionary match (or a quote mark rewritten by punctuation conversion) aligned
+// between the input and the output of a conversion, in bytes. Text outside the spans
+// is copied unchanged, so it maps one to one.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Span {
+    pub src_offset: usize,
+    pub src_len: usize,
+    pub dst_offset: usize,
+    pub dst_len: usize,
+}
+
+// Records the spans of one round. Every word observed is a slice of the round's input,
+// and each match shifts the rest of the output by its change in length.
+pub(crate) struct SpanRecorder {
+    base: usize,
+    shift: isize,
+    pub(crate) spans: Vec<Span>,
+}
+
+impl SpanRecorder {
+    pub(crate) fn new(input: &str) -> Self {
+        SpanRecorder {
+            base: input.as_ptr() as usize,
+            shift: 0,
+            spans: Vec::new(),
+        }
+    }
+}
+
+impl MatchObserver for SpanRecorder {
+    fn hit(&mut self, word: &str, value: &str) {
+        let src_offset = word.as_ptr() as usize - self.base;
+        self.spans.push(Span {
+            src_offset,
+            src_len: word.len(),
+            dst_offset: (src_offset as isize + self.shift) as usize,
+            dst_len: value.len(),
+        });
+        self.shift += value.len() as isize - word.len() as isize;
+    }
+
+    #[inline(always)]
+    fn miss(&mut self, _chars: usize) {}
+}
+
+// Spans of two rounds applied one after the other. Spans that overlap on the middle
+// text are joined into one, so every output span covers whole matches of both rounds.
+pub(crate) fn compose(first: &[Span], second: &[Span]) -> Vec<Span> {
+    let (mut i, mut j) = (0, 0);
+    // Length changes of the spans of each round consumed so far
+    let (mut first_shift, mut second_shift) = (0isize, 0isize);
+    let mut spans = Vec::with_capacity(first.len().max(second.len()));
+    while i < first.len() || j < second.len() {
+        let start = match (first.get(i), second.get(j)) {
+            (Some(a), Some(b)) => a.dst_offset.min(b.src_offset),
+            (Some(a), None) => a.dst_offset,
+            (None, Some(b)) => b.src_offset,
+            (None, None) => unreachable!(),
+        };
+        let src_offset = (start as isize - first_shift) as usize;
+        let dst_offset = (start as isize + second_shift) as usize;
+        let mut end = start;
+        // Take every span starting inside the group so far
+        loop {
+            let joins = |offset: usize, end: usize| offset < end || offset == start;
+            if let Some(a) = first.get(i).filter(|a| joins(a.dst_offset, end)) {
+                end = end.max(a.dst_offset + a.dst_len);
+                first_shift += a.dst_len as isize - a.src_len as isize;
+                i += 1;
+            } else if let Some(b) = second.get(j).filter(|b| joins(b.src_offset, end)) {
+                end = end.max(b.src_offset + b.src_len);
+                second_shift += b.dst_len as isize - b.src_len as isize;
+                j += 1;
+            } else {
+                break;
+            }
+        }
+        spans.push(Span {
+            src_offset,
+            src_len: (end as isize - first_shift) as usize - src_offset,
+            dst_offset,
+            dst_len: (end as isize + second_shift) as usize - dst_offset,
+        });
+    }
+    spans
+}
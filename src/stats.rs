@@ -0,0 +1,238 @@
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::OnceLock;
+
+use crate::OpenccConfig;
+
+// Most dictionary rounds of any config
+pub const MAX_ROUNDS: usize = crate::max_plan_rounds();
+// Match length histogram buckets: index n counts matches of n chars, the last bucket
+// everything longer
+pub const MATCH_LENGTH_BUCKETS: usize = 17;
+// Counter shards; each thread adds to one, a snapshot sums them all
+const SHARDS: usize = 16;
+
+// Snapshot of the counters of one handle, see OpenCC::stats
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct ConversionStats {
+    // Configs converted at least once since the last reset
+    pub configs: Vec<ConfigStats>,
+    pub match_lengths: [u64; MATCH_LENGTH_BUCKETS],
+}
+
+#[derive(Clone, Debug, PartialEq)]
+pub struct ConfigStats {
+    pub config: OpenccConfig,
+    pub calls: u64,
+    pub bytes_in: u64,
+    pub bytes_out: u64,
+    // Delimiter-bounded chunks the input was split into
+    pub chunks: u64,
+    pub rounds: Vec<RoundStats>,
+}
+
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct RoundStats {
+    pub nanos: u64,
+    // Words replaced from the dictionaries, and chars left as they were
+    pub hits: u64,
+    pub misses: u64,
+}
+
+// Opt-in counters of a handle. Nothing is allocated until they are first enabled, and
+// while disabled a conversion pays one relaxed load.
+pub(crate) struct Stats {
+    enabled: AtomicBool,
+    shards: OnceLock<Box<[Shard]>>,
+}
+
+// Aligned apart so threads on different shards do not share cache lines
+#[repr(align(128))]
+#[derive(Default)]
+pub(crate) struct Shard {
+    configs: [ConfigCounters; OpenccConfig::ALL.len()],
+    match_lengths: [AtomicU64; MATCH_LENGTH_BUCKETS],
+}
+
+#[derive(Default)]
+struct ConfigCounters {
+    calls: AtomicU64,
+    bytes_in: AtomicU64,
+    bytes_out: AtomicU64,
+    chunks: AtomicU64,
+    rounds: [[AtomicU64; 3]; MAX_ROUNDS],
+}
+
+// Counts gathered over one conversion and then added to a shard at once
+pub(crate) struct CallCounts {
+    pub(crate) bytes_in: usize,
+    pub(crate) bytes_out: usize,
+    pub(crate) chunks: usize,
+    pub(crate) rounds: [(u64, MatchCounts); MAX_ROUNDS],
+}
+
+#[derive(Clone, Copy, Default)]
+pub(crate) struct MatchCounts {
+    hits: u64,
+    misses: u64,
+    lengths: [u64; MATCH_LENGTH_BUCKETS],
+}
+
+// Told about every step of forward maximum matching. The unit impl does nothing and
+// compiles away, so only instrumented conversions pay for counting.
+pub(crate) trait MatchObserver {
+    fn hit(&mut self, word: &str, value: &str);
+    fn miss(&mut self, chars: usize);
+}
+
+impl MatchObserver for () {
+    #[inline(always)]
+    fn hit(&mut self, _word: &str, _value: &str) {}
+
+    #[inline(always)]
+    fn miss(&mut self, _chars: usize) {}
+}
+
+impl MatchObserver for MatchCounts {
+    fn hit(&mut self, word: &str, _value: &str) {
+        self.hits += 1;
+        self.lengths[word.chars().count().min(MATCH_LENGTH_BUCKETS - 1)] += 1;
+    }
+
+    fn miss(&mut self, chars: usize) {
+        self.misses += chars as u64;
+    }
+}
+
+impl CallCounts {
+    pub(crate) fn new(bytes_in: usize) -> Self {
+        CallCounts {
+            bytes_in,
+            bytes_out: 0,
+            chunks: 0,
+            rounds: Default::default(),
+        }
+    }
+}
+
+impl Stats {
+    pub(crate) fn new() -> Self {
+        Stats {
+            enabled: AtomicBool::new(false),
+            shards: OnceLock::new(),
+        }
+    }
+
+    pub(crate) fn is_enabled(&self) -> bool {
+        self.enabled.load(Ordering::Relaxed)
+    }
+
+    pub(crate) fn set_enabled(&self, enabled: bool) {
+        if enabled {
+            self.shards();
+        }
+        self.enabled.store(enabled, Ordering::Relaxed);
+    }
+
+    pub(crate) fn record(&self, config: OpenccConfig, counts: &CallCounts) {
+        let shard = &self.shards()[shard_index()];
+        let counters = &shard.configs[config as usize];
+        counters.calls.fetch_add(1, Ordering::Relaxed);
+        counters
+            .bytes_in
+            .fetch_add(counts.bytes_in as u64, Ordering::Relaxed);
+        counters
+            .bytes_out
+            .fetch_add(counts.bytes_out as u64, Ordering::Relaxed);
+        counters
+            .chunks
+            .fetch_add(counts.chunks as u64, Ordering::Relaxed);
+        let rounds = counters.rounds.iter().zip(&counts.rounds);
+        for (round, (nanos, matches)) in rounds.take(config.dict_rounds().len()) {
+            round[0].fetch_add(*nanos, Ordering::Relaxed);
+            round[1].fetch_add(matches.hits, Ordering::Relaxed);
+            round[2].fetch_add(matches.misses, Ordering::Relaxed);
+            for (bucket, &count) in shard.match_lengths.iter().zip(&matches.lengths) {
+                if count > 0 {
+                    bucket.fetch_add(count, Ordering::Relaxed);
+                }
+            }
+        }
+    }
+
+    pub(crate) fn snapshot(&self) -> ConversionStats {
+        let mut stats = ConversionStats::default();
+        let Some(shards) = self.shards.get() else {
+            return stats;
+        };
+        for config in OpenccConfig::ALL {
+            let mut config_stats = ConfigStats {
+                config,
+                calls: 0,
+                bytes_in: 0,
+                bytes_out: 0,
+                chunks: 0,
+                rounds: vec![RoundStats::default(); config.dict_rounds().len()],
+            };
+            for shard in shards.iter() {
+                let counters = &shard.configs[config as usize];
+                config_stats.calls += counters.calls.load(Ordering::Relaxed);
+                config_stats.bytes_in += counters.bytes_in.load(Ordering::Relaxed);
+                config_stats.bytes_out += counters.bytes_out.load(Ordering::Relaxed);
+                config_stats.chunks += counters.chunks.load(Ordering::Relaxed);
+                for (round, totals) in config_stats.rounds.iter_mut().zip(&counters.rounds) {
+                    round.nanos += totals[0].load(Ordering::Relaxed);
+                    round.hits += totals[1].load(Ordering::Relaxed);
+                    round.misses += totals[2].load(Ordering::Relaxed);
+                }
+            }
+            if config_stats.calls > 0 {
+                stats.configs.push(config_stats);
+            }
+        }
+        for shard in shards.iter() {
+            for (total, bucket) in stats.match_lengths.iter_mut().zip(&shard.match_lengths) {
+                *total += bucket.load(Ordering::Relaxed);
+            }
+        }
+        stats
+    }
+
+    // Counts from conversions running concurrently with the reset may survive it
+    pub(crate) fn reset(&self) {
+        let Some(shards) = self.shards.get() else {
+            return;
+        };
+        for shard in shards.iter() {
+            for counters in &shard.configs {
+                for counter in [
+                    &counters.calls,
+                    &counters.bytes_in,
+                    &counters.bytes_out,
+                    &counters.chunks,
+                ] {
+                    counter.store(0, Ordering::Relaxed);
+                }
+                for counter in counters.rounds.iter().flatten() {
+                    counter.store(0, Ordering::Relaxed);
+                }
+            }
+            for bucket in &shard.match_lengths {
+                bucket.store(0, Ordering::Relaxed);
+            }
+        }
+    }
+
+    fn shards(&self) -> &[Shard] {
+        self.shards
+            .get_or_init(|| (0..SHARDS).map(|_| Shard::default()).collect())
+    }
+}
+
+// Shard of the calling thread, handed out round-robin as threads first record
+fn shard_index() -> usize {
+    static NEXT_SHARD: AtomicUsize = AtomicUsize::new(0);
+    thread_local! {
+        static SHARD: usize = NEXT_SHARD.fetch_add(1, Ordering::Relaxed) % SHARDS;
+    }
+    SHARD.with(|shard| *shard)
+}
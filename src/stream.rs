@@ -0,0 +1,205 @@
+use crate::{Converter, OpenCC, ScriptScan};
+
+// Input an auto config holds back while zho_check is not settled. Text with little
+// Chinese in it could otherwise be held back to the end; past this much the target
+// is picked from the chars seen so far.
+const MAX_UNDECIDED_BYTES: usize = 64 * 1024;
+
+// Incremental conversion of unbounded input. Text is converted as it arrives and only
+// held back where the result could still change: an incomplete UTF-8 sequence, and
+// per round the tail of the current chunk that is shorter than the round's max word
+// length. Output is identical to converting the whole input in one call, except that
+// an auto config decides its target within the first MAX_UNDECIDED_BYTES bytes.
+pub struct ConversionStream<'a> {
+    converter: Converter<'a>,
+    // Auto configs: the target picked once zho_check is settled, the input held back
+    // until then and the scan over it so far
+    target: Option<usize>,
+    undecided: String,
+    script: ScriptScan,
+    stages: Vec<StreamStage>,
+    utf8_tail: Vec<u8>,
+}
+
+// Pending input of one dictionary round
+#[derive(Default)]
+struct StreamStage {
+    pending: String,
+    // Part of the chunk at the start of `pending` has already been emitted
+    mid_chunk: bool,
+}
+
+impl<'a> ConversionStream<'a> {
+    pub(crate) fn new(converter: Converter<'a>) -> Self {
+        let stages = StreamStage::for_rounds(&converter);
+        ConversionStream {
+            converter,
+            target: None,
+            undecided: String::new(),
+            script: ScriptScan::default(),
+            stages,
+            utf8_tail: Vec::new(),
+        }
+    }
+
+    // Feed the next piece of UTF-8 input; a multi-byte sequence may be split across
+    // calls. Returns whatever output is final so far. Invalid UTF-8 is replaced
+    // with U+FFFD.
+    pub fn feed(&mut self, input: &[u8]) -> String {
+        self.utf8_tail.extend_from_slice(input);
+        let mut text = String::with_capacity(self.utf8_tail.len());
+        let mut bytes = self.utf8_tail.as_slice();
+        loop {
+            match std::str::from_utf8(bytes) {
+                Ok(valid) => {
+                    text.push_str(valid);
+                    bytes = &[];
+                    break;
+                }
+                Err(err) => {
+                    let valid_up_to = err.valid_up_to();
+                    // SAFETY: from_utf8 validated the first valid_up_to bytes
+                    text.push_str(unsafe { std::str::from_utf8_unchecked(&bytes[..valid_up_to]) });
+                    match err.error_len() {
+                        Some(invalid) => {
+                            text.push(char::REPLACEMENT_CHARACTER);
+                            bytes = &bytes[valid_up_to + invalid..];
+                        }
+                        // Incomplete sequence at the end: wait for the next feed
+                        None => {
+                            bytes = &bytes[valid_up_to..];
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        let keep = bytes.len();
+        let consumed = self.utf8_tail.len() - keep;
+        self.utf8_tail.drain(..consumed);
+
+        self.run(text, false)
+    }
+
+    pub fn feed_str(&mut self, input: &str) -> String {
+        if self.utf8_tail.is_empty() {
+            self.run(input.to_string(), false)
+        } else {
+            self.feed(input.as_bytes())
+        }
+    }
+
+    // Flush everything still held back. The stream can be reused afterwards.
+    pub fn finish(&mut self) -> String {
+        let mut text = String::new();
+        if !self.utf8_tail.is_empty() {
+            text.push_str(&String::from_utf8_lossy(&self.utf8_tail));
+            self.utf8_tail.clear();
+        }
+
+        self.run(text, true)
+    }
+
+    fn run(&mut self, mut text: String, last: bool) -> String {
+        let opencc = self.converter.opencc;
+        if self.converter.is_auto() && self.target.is_none() {
+            // Only the new text is scanned; the scan keeps the counts of earlier feeds
+            opencc.scan_script(&mut self.script, &text);
+            self.undecided.push_str(&text);
+            let settled = self.script.settled || self.undecided.len() >= MAX_UNDECIDED_BYTES;
+            if !last && !settled {
+                return String::new();
+            }
+            text = std::mem::take(&mut self.undecided);
+            let target = self.script.verdict().0 as usize;
+            self.script = ScriptScan::default();
+            self.stages = StreamStage::for_rounds(&self.converter.targets[target]);
+            self.target = Some(target);
+        }
+        let converter = match self.target {
+            Some(target) => &self.converter.targets[target],
+            None => &self.converter,
+        };
+        for (stage, round) in self.stages.iter_mut().zip(converter.rounds().iter()) {
+            stage.pending.push_str(&text);
+            text = stage.convert(opencc, &round.dictionaries, round.max_word_length, last);
+        }
+        let output = converter.apply_punctuation(text);
+        if last {
+            // Detect afresh for the next input
+            self.target = None;
+        }
+
+        output
+    }
+}
+
+impl StreamStage {
+    fn for_rounds(converter: &Converter) -> Vec<StreamStage> {
+        converter
+            .rounds
+            .iter()
+            .map(|_| StreamStage::default())
+            .collect()
+    }
+
+    fn convert(
+        &mut self,
+        opencc: &OpenCC,
+        dictionaries: &[&crate::Trie],
+        max_word_length: usize,
+        last: bool,
+    ) -> String {
+        let mut output = String::with_capacity(self.pending.len());
+        let mut pos = 0;
+        // Complete chunks: everything up to and including a delimiter
+        while let Some(length) = opencc.delimiters.chunk_end(&self.pending[pos..]) {
+            let end = pos + length;
+            self.convert_chunk(opencc, pos, end, dictionaries, max_word_length, &mut output);
+            pos = end;
+        }
+        let tail = &self.pending[pos..];
+        if last {
+            if !tail.is_empty() {
+                self.convert_chunk(
+                    opencc,
+                    pos,
+                    self.pending.len(),
+                    dictionaries,
+                    max_word_length,
+                    &mut output,
+                );
+            }
+            pos = self.pending.len();
+        } else {
+            let consumed =
+                opencc.convert_prefix_into(tail, dictionaries, max_word_length, &mut output, true);
+            if consumed > 0 {
+                self.mid_chunk = true;
+            }
+            pos += consumed;
+        }
+        self.pending.drain(..pos);
+
+        output
+    }
+
+    fn convert_chunk(
+        &mut self,
+        opencc: &OpenCC,
+        start: usize,
+        end: usize,
+        dictionaries: &[&crate::Trie],
+        max_word_length: usize,
+        output: &mut String,
+    ) {
+        let chunk = &self.pending[start..end];
+        if start == 0 && self.mid_chunk {
+            // The rest of a chunk that was partly emitted: no lone-delimiter shortcut
+            opencc.convert_prefix_into(chunk, dictionaries, max_word_length, output, false);
+        } else {
+            opencc.convert_by_into(chunk, dictionaries, max_word_length, output);
+        }
+        self.mid_chunk = false;
+    }
+}
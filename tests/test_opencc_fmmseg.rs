@@ -1,4 +1,4 @@
-use opencc_fmmseg::{dictionary_lib, OpenCC};
+use opencc_fmmseg::{dictionary_lib, OpenCC, OpenccConfig, ParallelPolicy, Span};
 
 #[cfg(test)]
 mod tests {
@@ -79,6 +79,23 @@ mod tests {
         assert_eq!(actual_output, expected_output);
     }
 
+    #[test]
+    fn fused_rounds_match_multi_pass_test() {
+        let input = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。\n你好，意大利！SQL注入和U盘，软件打印机。";
+        let opencc = OpenCC::new();
+        for is_parallel in [true, false] {
+            opencc.set_parallel(is_parallel);
+            let traditional = opencc.s2t(input, false);
+            assert_eq!(opencc.s2tw(input, false), opencc.t2tw(&traditional));
+            assert_eq!(opencc.s2twp(input, false), opencc.t2twp(&traditional));
+            let taiwan = opencc.s2twp(input, false);
+            assert_eq!(
+                opencc.tw2sp(&taiwan, false),
+                opencc.t2s(&opencc.tw2tp(&taiwan), false)
+            );
+        }
+    }
+
     #[test]
     fn s2t_punct_test() {
         let input = "你好，世界！“龙马精神”！";
@@ -92,12 +109,30 @@ mod tests {
     fn s2t_punct_not_parallel_test() {
         let input = "你好，世界！“龙马精神”！";
         let expected_output = "你好，世界！「龍馬精神」！";
-        let mut opencc = OpenCC::new();
+        let opencc = OpenCC::new();
         opencc.set_parallel(false);
         let actual_output = opencc.s2t(input, true);
         assert_eq!(actual_output, expected_output);
     }
 
+    #[test]
+    fn converter_test() {
+        let input = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。";
+        let opencc = OpenCC::new();
+        let config = OpenccConfig::from_name("S2TWP").unwrap();
+        assert_eq!(config, OpenccConfig::S2twp);
+        let converter = opencc.converter(config, true);
+        assert_eq!(
+            converter.convert(input),
+            opencc.convert(input, "s2twp", true)
+        );
+        assert_eq!(
+            converter.convert(input),
+            "義大利羅浮宮裡收藏的「蒙娜麗莎的微笑」畫像是曠世之作。"
+        );
+        assert_eq!(OpenccConfig::from_name("s2s"), None);
+    }
+
     #[test]
     fn format_thousand_test() {
         let input = 1234567890;
@@ -132,6 +167,74 @@ mod tests {
         assert_eq!(dictionary.st_phrases.1, expected);
     }
 
+    #[test]
+    fn trie_longest_match_test() {
+        let entries = [("龙", "龍"), ("龙马", "龍馬"), ("龙马精神", "龍馬精神")];
+        let table = (
+            entries
+                .iter()
+                .map(|(k, v)| (k.to_string(), v.to_string()))
+                .collect(),
+            4,
+        );
+        let trie = dictionary_lib::Trie::from_dictionary(&table);
+        assert_eq!(trie.longest_match("龙马精神！", 4), Some((12, "龍馬精神")));
+        assert_eq!(trie.longest_match("龙马精神！", 3), Some((6, "龍馬")));
+        assert_eq!(trie.longest_match("龙马精", 4), Some((6, "龍馬")));
+        assert_eq!(trie.longest_match("马", 4), None);
+    }
+
+    #[test]
+    fn trie_single_char_test() {
+        let entries = [
+            ("a", "A"),
+            ("发", "發"),
+            ("髮", "发"),
+            ("𠀀", "𠀁"),
+            ("\u{10FFFF}", "x"),
+        ];
+        let table = (
+            entries
+                .iter()
+                .map(|(k, v)| (k.to_string(), v.to_string()))
+                .collect(),
+            1,
+        );
+        let trie = dictionary_lib::Trie::from_dictionary(&table);
+        for (key, value) in entries {
+            assert_eq!(trie.longest_match(key, 1), Some((key.len(), value)));
+        }
+        assert_eq!(trie.longest_match("发发", 2), Some((3, "發")));
+        // Same 256-codepoint pages as keys, but no entry
+        for missing in ["b", "叕", "𠀂", "\u{10FFFE}"] {
+            assert_eq!(trie.longest_match(missing, 1), None);
+        }
+    }
+
+    #[test]
+    fn merged_round_test() {
+        use dictionary_lib::DictId;
+        let dictionary = dictionary_lib::DictionaryMaxlength::new().unwrap();
+        let round = [DictId::StPhrases, DictId::StCharacters];
+        let merged = dictionary.round_tries(&round);
+        assert_eq!(merged.len(), 1);
+        let separate: Vec<_> = round.iter().map(|&id| dictionary.trie(id)).collect();
+        let text = "意大利罗浮宫里收藏的蒙娜丽莎的微笑画像是旷世之作，龙马精神";
+        for (start, _) in text.char_indices() {
+            let rest = &text[start..];
+            let mut expected: Option<(usize, &str)> = None;
+            for trie in &separate {
+                if let Some((length, value)) = trie.longest_match(rest, 16) {
+                    if expected.map_or(true, |(best, _)| length > best) {
+                        expected = Some((length, value));
+                    }
+                }
+            }
+            assert_eq!(merged[0].longest_match(rest, 16), expected);
+        }
+        assert_eq!(dictionary.round_tries(&[DictId::TwPhrases]).len(), 1);
+    }
+
     // Use this to generate "dictionary_maxlength.json" when you edit dicts data
     #[test]
     #[ignore]
@@ -166,9 +269,78 @@ mod tests {
         fs::remove_file(filename).unwrap();
     }
 
+    // Use this to regenerate "dictionary_maxlength.bin" after updating the JSON
+    #[test]
+    #[ignore]
+    fn test_serialize_to_binary() {
+        let filename = "dictionary_maxlength.bin";
+        let dictionary = dictionary_lib::DictionaryMaxlength::new().unwrap();
+        dictionary.serialize_to_binary(filename).unwrap();
+        let reloaded = dictionary_lib::DictionaryMaxlength::from_binary(filename).unwrap();
+        assert_eq!(reloaded.st_phrases.1, 16);
+    }
+
+    #[test]
+    fn embedded_binary_matches_json_test() {
+        let from_json = dictionary_lib::DictionaryMaxlength::new().unwrap();
+        let embedded = dictionary_lib::DictionaryMaxlength::from_embedded_binary().unwrap();
+        assert_eq!(embedded.st_phrases.1, from_json.st_phrases.1);
+        assert!(embedded.to_binary() == from_json.to_binary());
+    }
+
+    #[test]
+    fn binary_tables_test() {
+        let from_json = dictionary_lib::DictionaryMaxlength::new().unwrap();
+        let embedded = dictionary_lib::DictionaryMaxlength::from_embedded_binary().unwrap();
+        let filename = std::env::temp_dir().join("opencc_fmmseg_binary_tables_test.json");
+        let filename = filename.to_str().unwrap();
+        embedded.serialize_to_json(filename).unwrap();
+        let reloaded = dictionary_lib::DictionaryMaxlength::from_json(filename).unwrap();
+        fs::remove_file(filename).unwrap();
+
+        let mut loaded = embedded;
+        loaded.load_tables().unwrap();
+        for id in dictionary_lib::DictId::ALL {
+            assert!(reloaded.table(id) == from_json.table(id), "{:?}", id);
+            assert!(loaded.table(id) == from_json.table(id), "{:?}", id);
+        }
+    }
+
+    #[test]
+    fn from_binary_test() {
+        let filename = std::env::temp_dir().join("opencc_fmmseg_from_binary_test.bin");
+        let filename = filename.to_str().unwrap();
+        dictionary_lib::DictionaryMaxlength::from_dicts()
+            .serialize_to_binary(filename)
+            .unwrap();
+        let opencc = OpenCC::from_binary(filename);
+        assert_eq!(opencc.s2twp("你好，意大利！", false), "你好，義大利！");
+        fs::remove_file(filename).unwrap();
+        assert!(
+            dictionary_lib::DictionaryMaxlength::from_static_binary(b"not a dictionary").is_err()
+        );
+    }
+
+    #[test]
+    fn shared_dictionary_test() {
+        let first = OpenCC::new_shared();
+        let second = first.clone_handle();
+        second.set_parallel(false);
+        assert!(std::sync::Arc::ptr_eq(
+            first.dictionary(),
+            second.dictionary()
+        ));
+        assert!(std::sync::Arc::ptr_eq(
+            first.dictionary(),
+            OpenCC::new_shared().dictionary()
+        ));
+        assert_eq!(first.get_parallel(), true);
+        assert_eq!(second.s2t("龙马精神", false), first.s2t("龙马精神", false));
+    }
+
     #[test]
     fn is_parallel_test() {
-        let mut opencc = OpenCC::new();
+        let opencc = OpenCC::new();
         assert_eq!(opencc.get_parallel(), true);
         opencc.set_parallel(false);
         assert_eq!(opencc.get_parallel(), false);
@@ -179,4 +351,462 @@ mod tests {
         OpenCC::set_last_error("Some error here.");
         assert_eq!(OpenCC::get_last_error().unwrap(), "Some error here.");
     }
+
+    #[test]
+    fn convert_batch_test() {
+        let opencc = OpenCC::new();
+        let inputs = ["意大利罗浮宫", "", "“龙马精神”，汉字。", "abc"];
+        for parallel in [true, false] {
+            opencc.set_parallel(parallel);
+            let converter = opencc.converter(OpenccConfig::S2twp, true);
+            let expected: Vec<String> = inputs
+                .iter()
+                .map(|input| converter.convert(input))
+                .collect();
+            assert_eq!(converter.convert_batch(&inputs), expected);
+        }
+    }
+
+    #[test]
+    fn stream_matches_convert_test() {
+        let opencc = OpenCC::new();
+        let input = "“龙马精神”意大利罗浮宫里收藏的蒙娜丽莎的微笑，汉字信息处理系统\n\
+                     預設的記憶體和軟體，香港特別行政區的計程車、乾燥劑、SQL注入攻击U盘";
+        for config in OpenccConfig::ALL {
+            let expected = opencc.convert(input, config.as_str(), true);
+            for piece_size in [1, 2, 5, 64] {
+                let mut stream = opencc.stream(config, true);
+                let mut output = String::new();
+                for piece in input.as_bytes().chunks(piece_size) {
+                    output.push_str(&stream.feed(piece));
+                }
+                output.push_str(&stream.finish());
+                assert_eq!(output, expected, "{} / {}", config.as_str(), piece_size);
+            }
+        }
+    }
+
+    #[test]
+    fn stream_ascii_auto_test() {
+        let opencc = OpenCC::new();
+        let line = "All ASCII log line 0123456789, nothing to detect here.\n";
+        let mut stream = opencc.stream(OpenccConfig::Auto2t, false);
+        let mut output = String::new();
+        let mut fed = 0;
+        while output.is_empty() {
+            output.push_str(&stream.feed_str(line));
+            fed += 1;
+            assert!(fed * line.len() <= 128 * 1024, "no output before finish");
+        }
+        for _ in 0..fed {
+            output.push_str(&stream.feed_str("龙马精神\n"));
+        }
+        output.push_str(&stream.finish());
+        let expected = line.repeat(fed) + &"龙马精神\n".repeat(fed);
+        assert_eq!(output, expected);
+    }
+
+    #[test]
+    fn parallel_policy_test() {
+        let input = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”，龙马精神。".repeat(64);
+        let opencc = OpenCC::new();
+        let expected = opencc.s2twp(&input, true);
+        for policy in [
+            ParallelPolicy::Serial,
+            ParallelPolicy::Parallel,
+            ParallelPolicy::Threshold(input.len() + 1),
+            ParallelPolicy::with_max_threads(2, 0).unwrap(),
+        ] {
+            opencc.set_parallel_policy(policy);
+            assert_eq!(opencc.s2twp(&input, true), expected);
+            assert_eq!(
+                opencc.tw2sp(&expected, true),
+                opencc.clone_handle().tw2sp(&expected, true)
+            );
+        }
+    }
+
+    #[test]
+    fn work_unit_split_test() {
+        // Long runs without delimiters force cuts at chars no match can span
+        let inputs = [
+            "意大利罗浮宫里收藏的蒙娜丽莎的微笑".repeat(4000),
+            "SQL注入攻击U盘abc123汉字".repeat(4000),
+            "“龙马精神”，汉字。\n".repeat(4000),
+        ];
+        let serial = OpenCC::new();
+        serial.set_parallel_policy(ParallelPolicy::Serial);
+        let parallel = OpenCC::new();
+        parallel.set_parallel_policy(ParallelPolicy::Parallel);
+        for input in &inputs {
+            for config in OpenccConfig::ALL {
+                assert_eq!(
+                    parallel.convert(input, config.as_str(), true),
+                    serial.convert(input, config.as_str(), true),
+                    "{}",
+                    config.as_str()
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn concurrent_handle_test() {
+        let opencc = OpenCC::new();
+        let input = "龙马精神！意大利罗马是一座历史悠久的城市。".repeat(200);
+        let expected = opencc.convert(&input, "s2twp", true);
+        std::thread::scope(|scope| {
+            for i in 0..4 {
+                let (opencc, input, expected) = (&opencc, &input, &expected);
+                scope.spawn(move || {
+                    for _ in 0..20 {
+                        opencc.set_parallel(i % 2 == 0);
+                        assert_eq!(&opencc.convert(input, "s2twp", true), expected);
+                    }
+                    OpenCC::set_last_error(&format!("thread {}", i));
+                    assert_eq!(OpenCC::get_last_error(), Some(format!("thread {}", i)));
+                });
+            }
+        });
+    }
+
+    #[test]
+    fn punctuation_test() {
+        let opencc = OpenCC::new();
+        let input = "他说：“‘龙马’—精神”…";
+        assert_eq!(opencc.s2t(input, true), "他說：「『龍馬』—精神」…");
+        assert_eq!(
+            opencc.t2s("他說：「『龍馬』—精神」…", true),
+            "他说：“‘龙马’—精神”…"
+        );
+        assert_eq!(opencc.s2t(input, false), "他說：“‘龍馬’—精神”…");
+    }
+
+    #[test]
+    fn zho_check_confidence_test() {
+        let opencc = OpenCC::new();
+        assert_eq!(opencc.zho_check_with_confidence(""), (0, 0.0));
+        assert_eq!(opencc.zho_check_with_confidence("Hello, 123!"), (0, 0.0));
+        assert_eq!(
+            opencc.zho_check_with_confidence("你好，龙马精神！"),
+            (2, 1.0)
+        );
+        assert_eq!(opencc.zho_check_with_confidence("龍馬精神！"), (1, 1.0));
+        let (code, confidence) = opencc.zho_check_with_confidence("龍马精神");
+        assert_eq!(code, 1);
+        assert!(confidence > 0.0 && confidence < 1.0);
+        // Only a bounded prefix is scanned, not counting ASCII
+        let input = format!("{}{}", "abc 龙马".repeat(100), "龍馬");
+        assert_eq!(opencc.zho_check(&input), 2);
+    }
+
+    #[test]
+    fn auto_config_test() {
+        let opencc = OpenCC::new();
+        let simplified = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。";
+        let traditional = "義大利羅浮宮裡收藏的「蒙娜麗莎的微笑」畫像是曠世之作。";
+        assert_eq!(
+            opencc.convert(simplified, "auto2tw", true),
+            opencc.convert(simplified, "s2tw", true)
+        );
+        assert_eq!(
+            opencc.convert(traditional, "auto2tw", true),
+            opencc.convert(traditional, "t2tw", true)
+        );
+        assert_eq!(opencc.convert(traditional, "auto2t", true), traditional);
+        assert_eq!(
+            opencc.convert(traditional, "auto2s", true),
+            opencc.convert(traditional, "t2s", true)
+        );
+        assert_eq!(
+            opencc.convert("Hello, world!", "auto2s", true),
+            "Hello, world!"
+        );
+        // One-shot conversions build only the target the input picks
+        let converter = opencc.converter_for(OpenccConfig::Auto2tw, true, simplified);
+        assert_eq!(converter.config(), OpenccConfig::S2tw);
+        assert_eq!(converter.convert(simplified), opencc.s2tw(simplified, true));
+        let converter = opencc.converter(OpenccConfig::Auto2s, false);
+        assert_eq!(
+            converter.convert_batch(&[simplified, traditional]),
+            vec![simplified.to_string(), opencc.t2s(traditional, false)]
+        );
+    }
+
+    #[test]
+    fn stats_test() {
+        let opencc = OpenCC::new();
+        let input = "意大利罗浮宫里收藏的“蒙娜丽莎的微笑”画像是旷世之作。".repeat(100);
+        let expected = opencc.s2twp(&input, true);
+        assert!(opencc.stats().configs.is_empty());
+
+        opencc.set_stats_enabled(true);
+        assert_eq!(opencc.s2twp(&input, true), expected);
+        assert_eq!(
+            opencc.convert(&input, "auto2tw", true),
+            opencc.s2tw(&input, true)
+        );
+        let stats = opencc.stats();
+        let configs: Vec<_> = stats.configs.iter().map(|c| c.config).collect();
+        assert_eq!(configs, [OpenccConfig::S2tw, OpenccConfig::S2twp]);
+        let s2twp = &stats.configs[1];
+        assert_eq!((s2twp.calls, s2twp.bytes_in), (1, input.len() as u64));
+        assert_eq!(s2twp.bytes_out, expected.len() as u64);
+        assert_eq!(s2twp.chunks, 300);
+        assert_eq!(s2twp.rounds.len(), 3);
+        let first = s2twp.rounds[0];
+        assert!(first.hits > 0 && first.misses > 0);
+        let histogram_hits: u64 = stats.match_lengths.iter().sum();
+        let all_hits: u64 = stats
+            .configs
+            .iter()
+            .flat_map(|c| c.rounds.iter())
+            .map(|r| r.hits)
+            .sum();
+        assert_eq!(histogram_hits, all_hits);
+
+        opencc.reset_stats();
+        assert!(opencc.stats().configs.is_empty());
+        opencc.set_stats_enabled(false);
+        opencc.s2t(&input, true);
+        assert!(opencc.stats().configs.is_empty());
+    }
+
+    #[test]
+    fn lazy_table_loading_test() {
+        // Spoil the last table (jp_variants_rev); only configs using it should notice
+        let mut bytes = dictionary_lib::DictionaryMaxlength::from_embedded_binary()
+            .unwrap()
+            .to_binary();
+        let entry = 4 * (3 + 5 * 15);
+        let word = |at: usize| u32::from_le_bytes(bytes[at..at + 4].try_into().unwrap()) as usize;
+        let (offset, length) = (word(entry + 12), word(entry + 16));
+        bytes[offset..offset + length].fill(0xFF);
+        let dictionary =
+            dictionary_lib::DictionaryMaxlength::from_static_binary(Box::leak(bytes.into()))
+                .unwrap();
+        assert!(dictionary
+            .preload(&[dictionary_lib::DictId::StPhrases])
+            .is_ok());
+        // The failure is kept, not replaced by an empty table on first use
+        for _ in 0..2 {
+            assert!(dictionary
+                .preload(&[dictionary_lib::DictId::JpVariantsRev])
+                .is_err());
+        }
+        let opencc = OpenCC::with_dictionary(std::sync::Arc::new(dictionary));
+        assert_eq!(opencc.s2t("龙马精神", false), "龍馬精神");
+        assert!(opencc.preload(OpenccConfig::Auto2t).is_ok());
+        for _ in 0..2 {
+            OpenCC::take_last_error();
+            opencc.jp2t("広い");
+            assert!(OpenCC::get_last_error().is_some());
+            assert!(opencc.preload(OpenccConfig::Jp2t).is_err());
+        }
+
+        let opencc = OpenCC::with_configs(&["s2twp", "auto2hk"]);
+        assert_eq!(opencc.s2twp("你好，意大利！", false), "你好，義大利！");
+        assert_eq!(opencc.convert("汉字", "auto2hk", false), "漢字");
+    }
+
+    #[test]
+    fn conversion_cache_test() {
+        let opencc = OpenCC::new();
+        assert_eq!(opencc.cache_stats(), Default::default());
+        opencc.set_cache(64, 16);
+        let converted = opencc.convert("龙马精神！", "s2t", true);
+        assert_eq!(opencc.convert("龙马精神！", "s2t", true), converted);
+        // Punctuation is part of the key
+        assert_eq!(opencc.convert("龙马精神！", "s2t", false), "龍馬精神！");
+        // Longer inputs bypass the cache
+        opencc.convert("意大利罗浮宫里收藏的画像", "s2t", false);
+        let stats = opencc.cache_stats();
+        assert_eq!((stats.hits, stats.misses, stats.entries), (1, 2, 2));
+        assert_eq!(stats.capacity, 64);
+
+        // Stays bounded by the per-shard capacity
+        for i in 0..1000 {
+            opencc.convert(&format!("汉字{}", i), "s2tw", false);
+        }
+        assert!(opencc.cache_stats().entries <= 64);
+        let handle = opencc.clone_handle();
+        assert_eq!(handle.cache_stats().capacity, 64);
+
+        opencc.set_cache(0, 16);
+        assert_eq!(opencc.convert("龙马精神！", "s2t", true), converted);
+        assert_eq!(opencc.cache_stats(), Default::default());
+    }
+
+    #[test]
+    fn overlay_test() {
+        let opencc = OpenCC::new();
+        opencc.set_cache(64, 64);
+        assert_eq!(opencc.s2twp("鼠标和软件", false), "滑鼠和軟體");
+        let converter = opencc.converter(OpenccConfig::S2twp, false);
+        opencc
+            .add_overlay(
+                dictionary_lib::DictId::StPhrases,
+                &[("鼠标", "鼠標器"), ("软件", "軟件")],
+            )
+            .unwrap();
+        // Same-length built-in phrases lose to the overlay; later rounds still apply
+        assert_eq!(opencc.s2twp("鼠标和软件", false), "滑鼠器和軟體");
+        assert_eq!(opencc.s2t("鼠标和软件", false), "鼠標器和軟件");
+        // Converters made before the update keep the old entries
+        assert_eq!(converter.convert("鼠标和软件"), "滑鼠和軟體");
+        assert_eq!(
+            opencc.clone_handle().s2t("鼠标和软件", false),
+            "鼠標器和軟件"
+        );
+        // Entries accumulate per table
+        opencc
+            .add_overlay(dictionary_lib::DictId::StPhrases, &[("软件", "軟體")])
+            .unwrap();
+        assert_eq!(opencc.s2t("鼠标和软件", false), "鼠標器和軟體");
+        // Enough entries to merge the accumulated ones into one trie
+        let words: Vec<(String, String)> = (0..5000)
+            .map(|n| (format!("词{}", n), format!("詞{}", n)))
+            .collect();
+        let words: Vec<(&str, &str)> = words.iter().map(|(k, v)| (&**k, &**v)).collect();
+        opencc
+            .add_overlay(dictionary_lib::DictId::StPhrases, &words)
+            .unwrap();
+        assert_eq!(opencc.s2t("鼠标和软件词42", false), "鼠標器和軟體詞42");
+        assert!(opencc
+            .add_overlay(dictionary_lib::DictId::StPhrases, &[("你好，", "x")])
+            .is_err());
+        assert!(opencc.load_user_dict("NotATable.txt").is_err());
+
+        opencc.clear_overlays();
+        assert_eq!(opencc.s2t("鼠标和软件", false), "鼠標和軟件");
+        let mut stream = opencc.stream(OpenccConfig::S2t, false);
+        assert_eq!(
+            stream.feed_str("鼠标") + &stream.finish(),
+            opencc.s2t("鼠标", false)
+        );
+    }
+
+    #[test]
+    fn from_dicts_matches_json_test() {
+        let from_dicts = dictionary_lib::DictionaryMaxlength::from_dicts();
+        let from_json = dictionary_lib::DictionaryMaxlength::new().unwrap();
+        for id in dictionary_lib::DictId::ALL {
+            assert!(from_dicts.table(id) == from_json.table(id), "{:?}", id);
+        }
+    }
+
+    #[test]
+    fn convert_with_spans_test() {
+        let opencc = OpenCC::new();
+        let (output, spans) = opencc.convert_with_spans("U盘和软件", "s2twp", false);
+        assert_eq!(output, "隨身碟和軟體");
+        assert_eq!(
+            spans,
+            [
+                Span {
+                    src_offset: 0,
+                    src_len: 4,
+                    dst_offset: 0,
+                    dst_len: 9
+                },
+                Span {
+                    src_offset: 7,
+                    src_len: 6,
+                    dst_offset: 12,
+                    dst_len: 6
+                },
+            ]
+        );
+
+        // Quote marks rewritten by punctuation conversion get spans of their own
+        let (output, spans) = opencc.convert_with_spans("“软件”", "s2t", true);
+        assert_eq!(output, "「軟件」");
+        let offsets: Vec<_> = spans
+            .iter()
+            .map(|span| (span.src_offset, span.src_len, span.dst_offset, span.dst_len))
+            .collect();
+        assert_eq!(offsets, [(0, 3, 0, 3), (3, 3, 3, 3), (9, 3, 9, 3)]);
+
+        // Text between spans is copied as is, for every config
+        let input = "“龙马精神”，「預設的記憶體」，‘U盘’『軟體』\n".to_string()
+            + include_str!("../tools/opencc-rs/OneDay.txt");
+        let input = input.as_str();
+        for (config, punctuation) in OpenccConfig::ALL
+            .into_iter()
+            .flat_map(|config| [(config, false), (config, true)])
+        {
+            let converter = opencc.converter(config, punctuation);
+            let (output, spans) = converter.convert_with_spans(input);
+            assert_eq!(output, converter.convert(input), "{}", config.as_str());
+            let (mut src, mut dst) = (0, 0);
+            for span in spans.iter().chain([&Span {
+                src_offset: input.len(),
+                dst_offset: output.len(),
+                ..Span::default()
+            }]) {
+                assert!(span.src_offset >= src && span.src_offset - src == span.dst_offset - dst);
+                let (gap_in, gap_out) =
+                    (&input[src..span.src_offset], &output[dst..span.dst_offset]);
+                assert_eq!(gap_in, gap_out, "{}", config.as_str());
+                src = span.src_offset + span.src_len;
+                dst = span.dst_offset + span.dst_len;
+                assert!(input.is_char_boundary(src) && output.is_char_boundary(dst));
+            }
+        }
+    }
+
+    #[test]
+    fn spawn_releases_slots_test() {
+        use opencc_fmmseg::JobState;
+        use std::sync::mpsc;
+        use std::sync::Arc;
+
+        // One worker that survives panicking jobs, so jobs queue up behind each other
+        let pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(1)
+            .panic_handler(|_| {})
+            .build()
+            .unwrap();
+        let opencc = OpenCC::new();
+        opencc.set_parallel_policy(ParallelPolicy::Pool {
+            pool: Arc::new(pool),
+            threshold: usize::MAX,
+        });
+        opencc.set_max_pending_jobs(2);
+
+        let (release, blocked) = mpsc::channel::<()>();
+        let (done, finished) = mpsc::channel();
+        let first = opencc
+            .spawn(move |_| {
+                blocked.recv().unwrap();
+            })
+            .unwrap();
+        let sender = done.clone();
+        let second = opencc.spawn(move |cancelled| sender.send(cancelled).unwrap());
+        let second = second.unwrap();
+        assert!(opencc.spawn(|_| {}).is_none());
+
+        // A cancelled job gives its slot back before it gets to run
+        assert!(second.cancel());
+        assert_eq!(second.state(), JobState::Cancelled);
+        assert_eq!(opencc.pending_jobs(), 1);
+        let third = opencc.spawn(|_| panic!("job failed")).unwrap();
+        assert!(opencc.spawn(|_| {}).is_none());
+
+        release.send(()).unwrap();
+        assert!(finished.recv().unwrap());
+        let sender = done.clone();
+        opencc
+            .spawn(move |cancelled| sender.send(cancelled).unwrap())
+            .unwrap();
+        assert!(!finished.recv().unwrap());
+
+        // The panicking job gave its slot back too
+        assert_eq!(first.state(), JobState::Done);
+        assert_eq!(third.state(), JobState::Done);
+        assert!(!second.cancel() && !third.cancel());
+        while opencc.pending_jobs() > 0 {
+            std::thread::yield_now();
+        }
+    }
 }
@@ -6,12 +6,7 @@ use copypasta::ClipboardContext;
 use copypasta::ClipboardProvider;
 
 use opencc_fmmseg;
-use opencc_fmmseg::{find_max_utf8_length, format_thousand, OpenCC};
-
-const CONFIG_LIST: [&str; 16] = [
-    "s2t", "t2s", "s2tw", "tw2s", "s2twp", "tw2sp", "s2hk", "hk2s", "t2tw", "t2twp", "t2hk",
-    "tw2t", "tw2tp", "hk2t", "t2jp", "jp2t",
-];
+use opencc_fmmseg::{find_max_utf8_length, format_thousand, OpenCC, OpenccConfig};
 
 fn main() {
     const RED: &str = "\x1B[1;31m";
@@ -28,11 +23,12 @@ fn main() {
         config = args[1].clone().to_lowercase();
         if config == "help" {
             println!("Opencc-Clip-fmmseg Zho Converter version 1.0.0 Copyright (c) 2024 Bryan Lai");
-            println!("Usage: opencc-clip [s2t|t2s|s2tw|tw2s|s2twp|tw2sp|s2hk|hk2s|t2tw|tw2t|t2twp|tw2t|tw2tp|t2hk|hk2t|jp2t|t2jp|auto|help] [punct]\n");
+            let config_names = OpenccConfig::ALL.map(|config| config.as_str()).join("|");
+            println!("Usage: opencc-clip [{}|auto|help] [punct]\n", config_names);
             return;
         }
 
-        if !CONFIG_LIST.contains(&config.as_str()) {
+        if OpenccConfig::from_name(&config).is_none() {
             config = "auto".to_string()
         }
         if args.len() >= 2 {
@@ -64,6 +60,12 @@ fn main() {
                     2 => config = "s2t".to_string(),
                     _ => config = "none".to_string(),
                 }
+            } else if let Some(auto) = OpenccConfig::from_name(&config).filter(|c| c.is_auto()) {
+                // Resolve here, so the conversion below does not detect a second time
+                config = match auto.for_script(input_code) {
+                    Some(target) => target.as_str().to_string(),
+                    None => "none".to_string(),
+                };
             }
 
             if input_code == 0 || config == "t2jp" || config == "jp2t" {
@@ -80,9 +82,9 @@ fn main() {
                 display_output_code = "Traditional Chinese 繁体";
             }
 
-            match CONFIG_LIST.contains(&config.as_str()) {
-                true => output = opencc.convert(&contents, &config, punct),
-                false => output = contents.clone(),
+            match OpenccConfig::from_name(&config) {
+                Some(_) => output = opencc.convert(&contents, &config, punct),
+                None => output = contents.clone(),
             }
 
             if contents.len() > 600 {
@@ -1,21 +1,23 @@
-use std::fs::File;
+use std::collections::{BTreeMap, HashSet};
+use std::fs::{self, File};
 use std::io::{self, BufWriter, Read, Write};
+use std::path::{Component, Path, PathBuf};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{mpsc, Mutex, OnceLock};
+use std::thread;
+use std::time::Instant;
 
-use clap::{Arg, Command};
-use encoding_rs::Encoding;
+use clap::{Arg, ArgAction, Command};
+use encoding_rs::{CoderResult, Decoder, Encoder, Encoding};
 use encoding_rs_io::DecodeReaderBytesBuilder;
 
 use opencc_fmmseg;
-use opencc_fmmseg::OpenCC;
-
-const CONFIG_LIST: [&str; 16] = [
-    "s2t", "t2s", "s2tw", "tw2s", "s2twp", "tw2sp", "s2hk", "hk2s", "t2tw", "t2twp", "t2hk",
-    "tw2t", "tw2tp", "hk2t", "t2jp", "jp2t",
-];
+use opencc_fmmseg::{Converter, OpenCC, OpenccConfig};
 
 fn main() -> Result<(), Box<dyn std::error::Error>> {
     const BLUE: &str = "\x1B[1;34m";
     const RESET: &str = "\x1B[0m";
+    let config_names = OpenccConfig::ALL.map(|config| config.as_str()).join("|");
     let matches = Command::new("OpenCC Rust")
         .arg(
             Arg::new("input")
@@ -36,9 +38,7 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
                 .short('c')
                 .long("config")
                 .value_name("conversion")
-                .help(
-                    "Conversion configuration: [s2t|s2tw|s2twp|s2hk|t2s|tw2s|tw2sp|hk2s|jp2t|t2jp]",
-                )
+                .help(format!("Conversion configuration: [{}]", config_names))
                 .required(true),
         )
         .arg(
@@ -49,6 +49,20 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
                 .default_value("false")
                 .help("Punctuation conversion: [true|false]"),
         )
+        .arg(
+            Arg::new("pipeline")
+                .long("pipeline")
+                .action(ArgAction::SetTrue)
+                .help("Convert in blocks, overlapping reading, conversion and writing"),
+        )
+        .arg(
+            Arg::new("block_size")
+                .long("block-size")
+                .value_name("MiB")
+                .default_value("4")
+                .value_parser(clap::value_parser!(usize))
+                .help("Block size for --pipeline"),
+        )
         .arg(
             Arg::new("in_enc")
                 .long("in-enc")
@@ -63,6 +77,30 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
                 .default_value("UTF-8")
                 .help("Encoding for output"),
         )
+        .arg(
+            Arg::new("paths")
+                .value_name("path")
+                .num_args(1..)
+                .help("Files or directories to convert in batch mode (with --output-dir)"),
+        )
+        .arg(
+            Arg::new("file_list")
+                .long("file-list")
+                .value_name("file")
+                .help("Read batch mode input paths from <file>, one per line"),
+        )
+        .arg(
+            Arg::new("output_dir")
+                .long("output-dir")
+                .value_name("dir")
+                .help("Batch mode: convert every input file into <dir>, keeping relative paths"),
+        )
+        .arg(
+            Arg::new("ext")
+                .long("ext")
+                .value_name("list")
+                .help("Batch mode: extensions to convert in directories, e.g. txt,srt"),
+        )
         .about(format!(
             "{}OpenCC Rust: Command Line Open Chinese Converter{}",
             BLUE, RESET
@@ -72,16 +110,76 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     let input_file = matches.get_one::<String>("input");
     let output_file = matches.get_one::<String>("output");
     let config = matches.get_one::<String>("config").unwrap().as_str();
-    if !CONFIG_LIST.contains(&config) {
+    let Some(resolved_config) = OpenccConfig::from_name(config) else {
         println!("Invalid config: {}", config);
-        println!("Valid Config are: [s2t|s2tw|s2twp|s2hk|t2s|tw2s|tw2sp|hk2s|jp2t|t2jp]");
+        println!("Valid Config are: [{}]", config_names);
         return Ok(());
-    }
+    };
     let punctuation = matches
         .get_one::<String>("punct")
         .map_or(false, |value| value == "true");
 
-    let mut input: Box<dyn Read> = match input_file {
+    // Without --output-dir, batch inputs would be ignored in favour of stdin
+    let batch_input = ["paths", "file_list", "ext"]
+        .iter()
+        .any(|id| matches.contains_id(id));
+    if batch_input && !matches.contains_id("output_dir") {
+        return Err("Batch mode inputs need --output-dir".into());
+    }
+    if let Some(output_dir) = matches.get_one::<String>("output_dir") {
+        let mut paths: Vec<String> = matches
+            .get_many::<String>("paths")
+            .map_or_else(Vec::new, |paths| paths.cloned().collect());
+        if let Some(file_list) = matches.get_one::<String>("file_list") {
+            let list = match file_list.as_str() {
+                "-" => io::read_to_string(io::stdin())?,
+                _ => fs::read_to_string(file_list)?,
+            };
+            paths.extend(
+                list.lines()
+                    .filter(|line| !line.is_empty())
+                    .map(String::from),
+            );
+        }
+        let extensions: Option<Vec<String>> = matches.get_one::<String>("ext").map(|list| {
+            list.split(',')
+                .map(|ext| ext.trim().trim_start_matches('.').to_ascii_lowercase())
+                .collect()
+        });
+        let encodings = ["in_enc", "out_enc"].map(|name| {
+            let label = matches.get_one::<String>(name).unwrap();
+            Encoding::for_label(label.as_bytes())
+                .ok_or_else(|| format!("Unsupported encoding: {}", label))
+        });
+        let [in_encoding, out_encoding] = encodings;
+        let jobs = collect_batch(&paths, extensions.as_deref(), Path::new(output_dir))?;
+        let opencc = OpenCC::new();
+        let summary = convert_batch(
+            &opencc,
+            resolved_config,
+            punctuation,
+            &jobs,
+            in_encoding?,
+            out_encoding?,
+        );
+        let seconds = summary.elapsed.max(1e-9);
+        println!(
+            "{BLUE}Batch conversion completed ({config}): {} files, {} failed, {} -> {} bytes in {:.3} s ({:.1} MB/s, {:.0} files/s){RESET}",
+            summary.files,
+            summary.failed,
+            summary.bytes_in,
+            summary.bytes_out,
+            summary.elapsed,
+            summary.bytes_in as f64 / seconds / 1e6,
+            summary.files as f64 / seconds,
+        );
+        if summary.failed > 0 {
+            return Err(format!("{} files failed to convert", summary.failed).into());
+        }
+        return Ok(());
+    }
+
+    let mut input: Box<dyn Read + Send> = match input_file {
         Some(file_name) => Box::new(File::open(file_name)?),
         None => {
             println!(
@@ -98,6 +196,42 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
 
     let mut output_buf = BufWriter::new(output);
 
+    if matches.get_flag("pipeline") {
+        let in_enc = matches.get_one::<String>("in_enc").unwrap().as_str();
+        let decoder = match in_enc {
+            "UTF-8" => encoding_rs::UTF_8.new_decoder_without_bom_handling(),
+            _ => match Encoding::for_label(in_enc.as_bytes()) {
+                None => return Err(format!("Unsupported input encoding: {}", in_enc).into()),
+                Some(encoding) => encoding.new_decoder(),
+            },
+        };
+        let out_enc = matches.get_one::<String>("out_enc").unwrap().as_str();
+        let encoder = match out_enc {
+            "UTF-8" => None,
+            _ => match Encoding::for_label(out_enc.as_bytes()) {
+                None => return Err(format!("Unsupported output encoding: {}", out_enc).into()),
+                Some(encoding) => Some(encoding.new_encoder()),
+            },
+        };
+        let block_size = (*matches.get_one::<usize>("block_size").unwrap()).max(1) << 20;
+        let opencc = OpenCC::new();
+        // Each block is converted serially; the pipeline runs blocks in parallel
+        opencc.set_parallel(false);
+        convert_pipelined(
+            &opencc,
+            resolved_config,
+            punctuation,
+            input,
+            &mut output_buf,
+            decoder,
+            encoder,
+            block_size,
+        )?;
+        output_buf.flush()?;
+        print_completed(config, input_file, output_file);
+        return Ok(());
+    }
+
     let mut input_str = String::new();
     let in_enc = matches.get_one::<String>("in_enc").unwrap().as_str();
     match in_enc {
@@ -141,6 +275,14 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
 
     output_buf.flush()?; // Flush buffer to ensure all data is written
 
+    print_completed(config, input_file, output_file);
+
+    Ok(())
+}
+
+fn print_completed(config: &str, input_file: Option<&String>, output_file: Option<&String>) {
+    const BLUE: &str = "\x1B[1;34m";
+    const RESET: &str = "\x1B[0m";
     if let Some(input_file) = input_file {
         println!(
             "{BLUE}Conversion completed ({config}): {} -> {}{RESET}",
@@ -153,6 +295,437 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
             output_file.unwrap_or(&"stdout".to_string())
         );
     }
+}
+
+// Pipelined conversion: a reader thread decodes the input into blocks of about
+// `block_size` bytes that end right after a delimiter, worker threads convert blocks
+// concurrently, and the calling thread encodes and writes them back in order. At most
+// two blocks per worker are in flight, so memory does not grow with the input size.
+// An auto config is resolved once, from the first block, so every block gets the
+// same target.
+fn convert_pipelined(
+    opencc: &OpenCC,
+    config: OpenccConfig,
+    punctuation: bool,
+    input: Box<dyn Read + Send>,
+    output: &mut dyn Write,
+    decoder: Decoder,
+    encoder: Option<Encoder>,
+    block_size: usize,
+) -> io::Result<()> {
+    let workers = thread::available_parallelism().map_or(4, |n| n.get());
+    let in_flight = 2 * workers;
+    // A block may only be read once a token is free; the writer returns it
+    let (token_tx, token_rx) = mpsc::sync_channel::<()>(in_flight);
+    for _ in 0..in_flight {
+        token_tx.send(()).unwrap();
+    }
+    let (block_tx, block_rx) = mpsc::sync_channel::<(usize, String)>(in_flight);
+    let block_rx = Mutex::new(block_rx);
+    let (done_tx, done_rx) = mpsc::sync_channel::<(usize, String)>(in_flight);
+    // None leaves the text unchanged
+    let converter = OnceLock::<Option<Converter>>::new();
+    if !config.is_auto() {
+        let _ = converter.set(Some(opencc.converter(config, punctuation)));
+    }
+    let resolve = |text: &str| {
+        converter.get_or_init(|| {
+            config
+                .for_script(opencc.zho_check(text))
+                .map(|target| opencc.converter(target, punctuation))
+        });
+    };
+
+    thread::scope(|scope| {
+        let reader = scope.spawn(move || {
+            read_blocks(opencc, input, decoder, block_size, token_rx, block_tx, resolve)
+        });
+        for _ in 0..workers {
+            let done_tx = done_tx.clone();
+            let block_rx = &block_rx;
+            let converter = &converter;
+            scope.spawn(move || loop {
+                let block = block_rx.lock().unwrap().recv();
+                match block {
+                    Ok((index, text)) => {
+                        // The reader resolved the converter before sending the first block
+                        let converted = match converter.get().unwrap() {
+                            Some(converter) => converter.convert(&text),
+                            None => text,
+                        };
+                        if done_tx.send((index, converted)).is_err() {
+                            break;
+                        }
+                    }
+                    Err(_) => break,
+                }
+            });
+        }
+        drop(done_tx);
+
+        let written = write_blocks(done_rx, token_tx, output, encoder);
+        let read = reader.join().unwrap();
+        written.and(read)
+    })
+}
+
+fn read_blocks(
+    opencc: &OpenCC,
+    mut input: Box<dyn Read + Send>,
+    mut decoder: Decoder,
+    block_size: usize,
+    token_rx: mpsc::Receiver<()>,
+    block_tx: mpsc::SyncSender<(usize, String)>,
+    resolve: impl Fn(&str),
+) -> io::Result<()> {
+    let mut bytes = vec![0; block_size];
+    let mut carry = String::new();
+    let mut index = 0;
+    loop {
+        let mut filled = 0;
+        while filled < bytes.len() {
+            match input.read(&mut bytes[filled..]) {
+                Ok(0) => break,
+                Ok(n) => filled += n,
+                Err(err) if err.kind() == io::ErrorKind::Interrupted => {}
+                Err(err) => return Err(err),
+            }
+        }
+        let last = filled < bytes.len();
+
+        let mut text = std::mem::take(&mut carry);
+        decode_into(&mut decoder, &bytes[..filled], &mut text, last);
+        // Keep the text after the last delimiter for the next block
+        if !last {
+            if let Some((at, ch)) = text
+                .char_indices()
+                .rev()
+                .find(|&(_, ch)| opencc.is_delimiter(ch))
+            {
+                carry = text.split_off(at + ch.len_utf8());
+            } else {
+                carry = text;
+                continue;
+            }
+        }
+        if !text.is_empty() {
+            if index == 0 {
+                resolve(&text);
+            }
+            // Either channel closing means the writer stopped; its error is reported
+            if token_rx.recv().is_err() || block_tx.send((index, text)).is_err() {
+                return Ok(());
+            }
+            index += 1;
+        }
+        if last {
+            return Ok(());
+        }
+    }
+}
+
+fn write_blocks(
+    done_rx: mpsc::Receiver<(usize, String)>,
+    token_tx: mpsc::SyncSender<()>,
+    output: &mut dyn Write,
+    mut encoder: Option<Encoder>,
+) -> io::Result<()> {
+    let mut converted = BTreeMap::new();
+    let mut next = 0;
+    let mut bytes = Vec::new();
+    for (index, text) in done_rx {
+        converted.insert(index, text);
+        while let Some(text) = converted.remove(&next) {
+            match encoder.as_mut() {
+                None => output.write_all(text.as_bytes())?,
+                Some(encoder) => {
+                    bytes.clear();
+                    encode_into(encoder, &text, &mut bytes, false);
+                    output.write_all(&bytes)?;
+                }
+            }
+            next += 1;
+            let _ = token_tx.send(());
+        }
+    }
+    if let Some(encoder) = encoder.as_mut() {
+        bytes.clear();
+        encode_into(encoder, "", &mut bytes, true);
+        output.write_all(&bytes)?;
+    }
+
+    Ok(())
+}
+
+fn decode_into(decoder: &mut Decoder, mut src: &[u8], dst: &mut String, last: bool) {
+    loop {
+        let needed = decoder.max_utf8_buffer_length(src.len());
+        dst.reserve(needed.unwrap_or(3 * src.len()) + 16);
+        let (result, read, _) = decoder.decode_to_string(src, dst, last);
+        src = &src[read..];
+        if let CoderResult::InputEmpty = result {
+            break;
+        }
+    }
+}
+
+// Unmappable characters become numeric character references, like Encoding::encode
+fn encode_into(encoder: &mut Encoder, mut src: &str, dst: &mut Vec<u8>, last: bool) {
+    loop {
+        let needed = encoder.max_buffer_length_from_utf8_if_no_unmappables(src.len());
+        dst.reserve(needed.unwrap_or(4 * src.len()) + 16);
+        let (result, read, _) = encoder.encode_from_utf8_to_vec(src, dst, last);
+        src = &src[read..];
+        if let CoderResult::InputEmpty = result {
+            break;
+        }
+    }
+}
+
+// One file of a batch: where it is read from and written to
+struct BatchJob {
+    input: PathBuf,
+    output: PathBuf,
+}
+
+#[derive(Default)]
+struct BatchSummary {
+    files: usize,
+    failed: usize,
+    bytes_in: u64,
+    bytes_out: u64,
+    elapsed: f64,
+}
+
+// Expand batch paths into jobs. Files found under a directory keep their path relative
+// to it; a file named directly keeps its relative path, or just its name when the path
+// is absolute or leaves the current directory.
+fn collect_batch(
+    paths: &[String],
+    extensions: Option<&[String]>,
+    output_dir: &Path,
+) -> io::Result<Vec<BatchJob>> {
+    let mut jobs = Vec::new();
+    for path in paths.iter().map(Path::new) {
+        if path.is_dir() {
+            let mut files = Vec::new();
+            walk_dir(path, &mut files)?;
+            files.retain(|file| {
+                extensions.map_or(true, |extensions| {
+                    file.extension().map_or(false, |ext| {
+                        let ext = ext.to_string_lossy().to_ascii_lowercase();
+                        extensions.contains(&ext)
+                    })
+                })
+            });
+            files.sort();
+            for file in files {
+                let relative = file.strip_prefix(path).unwrap().to_path_buf();
+                jobs.push(BatchJob {
+                    output: output_dir.join(relative),
+                    input: file,
+                });
+            }
+        } else {
+            let inside = path
+                .components()
+                .all(|component| matches!(component, Component::Normal(_) | Component::CurDir));
+            let relative = match path.file_name() {
+                Some(name) if !inside => Path::new(name),
+                _ => path,
+            };
+            jobs.push(BatchJob {
+                output: output_dir.join(relative),
+                input: path.to_path_buf(),
+            });
+        }
+    }
+    let mut outputs = HashSet::new();
+    for job in &jobs {
+        if !outputs.insert(&job.output) {
+            let message = format!("Two inputs map to {}", job.output.display());
+            return Err(io::Error::new(io::ErrorKind::InvalidInput, message));
+        }
+    }
 
+    Ok(jobs)
+}
+
+fn walk_dir(dir: &Path, files: &mut Vec<PathBuf>) -> io::Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        if file_type.is_dir() {
+            walk_dir(&entry.path(), files)?;
+        } else if file_type.is_file() {
+            files.push(entry.path());
+        }
+    }
     Ok(())
 }
+
+// Batch conversion with one dictionary load for every file. Worker threads take files
+// in turn, so the parallelism is across files; a file is only split up further when
+// it is large enough for the handle's parallel policy. Converted files are handed to a
+// few writer threads through a bounded queue, so a slow disk holds the workers back
+// instead of buffering every output. A file that fails is reported and skipped.
+fn convert_batch(
+    opencc: &OpenCC,
+    config: OpenccConfig,
+    punctuation: bool,
+    jobs: &[BatchJob],
+    in_encoding: &'static Encoding,
+    out_encoding: &'static Encoding,
+) -> BatchSummary {
+    let started = Instant::now();
+    let workers = thread::available_parallelism().map_or(4, |n| n.get());
+    let writers = (workers / 2).clamp(1, 4);
+    let next = AtomicUsize::new(0);
+    let (files, failed) = (AtomicUsize::new(0), AtomicUsize::new(0));
+    let (bytes_in, bytes_out) = (AtomicU64::new(0), AtomicU64::new(0));
+    // None is an auto config, resolved for each file
+    let converter = (!config.is_auto()).then(|| opencc.converter(config, punctuation));
+    let fail = |path: &Path, err: &dyn std::fmt::Display| {
+        eprintln!("{}: {}", path.display(), err);
+        failed.fetch_add(1, Ordering::Relaxed);
+    };
+
+    let (write_tx, write_rx) = mpsc::sync_channel::<(&BatchJob, Vec<u8>)>(2 * workers);
+    let write_rx = Mutex::new(write_rx);
+
+    thread::scope(|scope| {
+        for _ in 0..writers {
+            let write_rx = &write_rx;
+            let (files, bytes_out, fail) = (&files, &bytes_out, &fail);
+            scope.spawn(move || loop {
+                let item = write_rx.lock().unwrap().recv();
+                let Ok((job, bytes)) = item else { break };
+                let written = match job.output.parent() {
+                    Some(parent) => fs::create_dir_all(parent),
+                    None => Ok(()),
+                }
+                .and_then(|()| fs::write(&job.output, &bytes));
+                match written {
+                    Ok(()) => {
+                        files.fetch_add(1, Ordering::Relaxed);
+                        bytes_out.fetch_add(bytes.len() as u64, Ordering::Relaxed);
+                    }
+                    Err(err) => fail(&job.output, &err),
+                }
+            });
+        }
+        for _ in 0..workers {
+            let write_tx = write_tx.clone();
+            let (next, bytes_in, fail) = (&next, &bytes_in, &fail);
+            let converter = converter.as_ref();
+            scope.spawn(move || loop {
+                let Some(job) = jobs.get(next.fetch_add(1, Ordering::Relaxed)) else {
+                    break;
+                };
+                let converted = convert_file(
+                    opencc,
+                    config,
+                    punctuation,
+                    converter,
+                    job,
+                    in_encoding,
+                    out_encoding,
+                );
+                match converted {
+                    Ok((read, bytes)) => {
+                        bytes_in.fetch_add(read, Ordering::Relaxed);
+                        if write_tx.send((job, bytes)).is_err() {
+                            break;
+                        }
+                    }
+                    Err(err) => fail(&job.input, &err),
+                }
+            });
+        }
+        drop(write_tx);
+    });
+
+    BatchSummary {
+        files: files.into_inner(),
+        failed: failed.into_inner(),
+        bytes_in: bytes_in.into_inner(),
+        bytes_out: bytes_out.into_inner(),
+        elapsed: started.elapsed().as_secs_f64(),
+    }
+}
+
+// Files at least this large are memory-mapped rather than read
+const MMAP_MIN_BYTES: u64 = 64 * 1024;
+
+enum FileBytes {
+    Mapped(memmap2::Mmap),
+    Read(Vec<u8>),
+}
+
+impl std::ops::Deref for FileBytes {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            FileBytes::Mapped(mmap) => mmap,
+            FileBytes::Read(bytes) => bytes,
+        }
+    }
+}
+
+fn read_file(path: &Path) -> io::Result<FileBytes> {
+    let mut file = File::open(path)?;
+    let len = file.metadata()?.len();
+    if len >= MMAP_MIN_BYTES {
+        // The mapping is dropped before the output is written, and an output never
+        // overwrites its own input (see convert_file)
+        if let Ok(mmap) = unsafe { memmap2::Mmap::map(&file) } {
+            return Ok(FileBytes::Mapped(mmap));
+        }
+    }
+    let mut bytes = Vec::with_capacity(len as usize);
+    file.read_to_end(&mut bytes)?;
+    Ok(FileBytes::Read(bytes))
+}
+
+// Returns the number of input bytes and the encoded output
+fn convert_file(
+    opencc: &OpenCC,
+    config: OpenccConfig,
+    punctuation: bool,
+    converter: Option<&Converter>,
+    job: &BatchJob,
+    in_encoding: &'static Encoding,
+    out_encoding: &'static Encoding,
+) -> io::Result<(u64, Vec<u8>)> {
+    if let (Ok(input), Ok(output)) = (job.input.canonicalize(), job.output.canonicalize()) {
+        if input == output {
+            let message = "output would overwrite the input";
+            return Err(io::Error::new(io::ErrorKind::InvalidInput, message));
+        }
+    }
+    let bytes = read_file(&job.input)?;
+    let text = if in_encoding == encoding_rs::UTF_8 {
+        // A BOM is dropped as for other encodings, but invalid UTF-8 fails the file
+        let bytes = bytes.strip_prefix(b"\xEF\xBB\xBF").unwrap_or(&bytes);
+        std::str::from_utf8(bytes)
+            .map(std::borrow::Cow::Borrowed)
+            .map_err(|err| io::Error::new(io::ErrorKind::InvalidData, err))?
+    } else {
+        in_encoding.decode_with_bom_removal(&bytes).0
+    };
+    let converted = match converter {
+        Some(converter) => converter.convert(&text),
+        None => match config.for_script(opencc.zho_check(&text)) {
+            Some(target) => opencc.converter(target, punctuation).convert(&text),
+            None => text.to_string(),
+        },
+    };
+    let output = if out_encoding == encoding_rs::UTF_8 {
+        converted.into_bytes()
+    } else {
+        out_encoding.encode(&converted).0.into_owned()
+    };
+
+    Ok((bytes.len() as u64, output))
+}